@@ -0,0 +1,274 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_console.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "power/power_profile.h"
+#include "scale/ble.h"
+#include "stream/usb_stream.h"
+#include "ui/controller/app_ctrl.h"
+#include "diagnostics.h"
+#include "console.h"
+
+// Command shell on the USB-Serial-JTAG port. The stream task reads the lines, the binary stream
+// and the log share the port. "help" lists the commands.
+//
+// brightness, refresh and interval change the FULL power profile, so they take effect at once
+// while the battery is fine and come back when a lower profile is left. "save" keeps them and
+// the default log level in NVS, they are applied again at boot. The profiles belong to the
+// controller task, so the new values wait here until it picks them up.
+
+#define TUNABLES_NAMESPACE "tunables"
+#define CONSOLE_LINE_MAX 64
+
+static const char *TAG = "console";
+
+static esp_log_level_t default_log_level = CONFIG_LOG_DEFAULT_LEVEL;
+
+// POWER_PROFILE_KEEP = unchanged, taken by console_apply_tunables()
+static atomic_int pending_brightness = POWER_PROFILE_KEEP;
+static atomic_int pending_refresh_ms = POWER_PROFILE_KEEP;
+static atomic_int pending_conn_ms = POWER_PROFILE_KEEP;
+
+static void set_tunables(int brightness, int32_t refresh_ms, int32_t conn_ms)
+{
+    if (brightness != POWER_PROFILE_KEEP)
+    {
+        atomic_store(&pending_brightness, brightness);
+    }
+    if (refresh_ms != POWER_PROFILE_KEEP)
+    {
+        atomic_store(&pending_refresh_ms, refresh_ms);
+    }
+    if (conn_ms != POWER_PROFILE_KEEP)
+    {
+        atomic_store(&pending_conn_ms, conn_ms);
+    }
+    app_ctrl_post(CTRL_EVT_TUNE);
+}
+
+// Called by the controller task
+void console_apply_tunables(void)
+{
+    power_profile_set_full(atomic_exchange(&pending_brightness, POWER_PROFILE_KEEP),
+                           atomic_exchange(&pending_refresh_ms, POWER_PROFILE_KEEP),
+                           atomic_exchange(&pending_conn_ms, POWER_PROFILE_KEEP));
+}
+
+static int cmd_stats(int argc, char **argv)
+{
+    // the snapshot keeps state between calls, so it is taken on the controller task
+    app_ctrl_post(CTRL_EVT_DIAG);
+    return 0;
+}
+
+static int cmd_mem(int argc, char **argv)
+{
+    diag_memory_report();
+    return 0;
+}
+
+static int cmd_ble(int argc, char **argv)
+{
+    scale_log_links();
+    return 0;
+}
+
+static int cmd_brightness(int argc, char **argv)
+{
+    int level = argc == 2 ? atoi(argv[1]) : 0;
+    if (level < 1 || level > 100)
+    {
+        printf("brightness <1..100>\n");
+        return 1;
+    }
+    set_tunables(level, POWER_PROFILE_KEEP, POWER_PROFILE_KEEP);
+    return 0;
+}
+
+static int cmd_refresh(int argc, char **argv)
+{
+    int period_ms = argc == 2 ? atoi(argv[1]) : 0;
+    if (period_ms < 5 || period_ms > 1000)
+    {
+        printf("refresh <5..1000 ms>\n");
+        return 1;
+    }
+    set_tunables(POWER_PROFILE_KEEP, period_ms, POWER_PROFILE_KEEP);
+    return 0;
+}
+
+static int cmd_interval(int argc, char **argv)
+{
+    // the spec allows 7.5 ms to 4 s, the supervision timeout grows with the interval. 0 goes back
+    // to the interval the scale asked for.
+    int interval_ms = argc == 2 ? atoi(argv[1]) : -1;
+    if (interval_ms != 0 && (interval_ms < 8 || interval_ms > 4000))
+    {
+        printf("interval <0|8..4000 ms>, 0 = leave it to the scale\n");
+        return 1;
+    }
+    set_tunables(POWER_PROFILE_KEEP, POWER_PROFILE_KEEP, interval_ms);
+    return 0;
+}
+
+static bool parse_level(const char *name, esp_log_level_t *level)
+{
+    static const char *const names[] = {"none", "error", "warn", "info", "debug", "verbose"};
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *level = (esp_log_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int cmd_log(int argc, char **argv)
+{
+    esp_log_level_t level;
+    if (argc != 3 || !parse_level(argv[2], &level))
+    {
+        printf("log <tag|*> <none|error|warn|info|debug|verbose>\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "*") == 0)
+    {
+        default_log_level = level;
+    }
+    esp_log_level_set(argv[1], level);
+    return 0;
+}
+
+static int cmd_stream(int argc, char **argv)
+{
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0))
+    {
+        printf("stream <on|off>\n");
+        return 1;
+    }
+    usb_stream_set_enabled(strcmp(argv[1], "on") == 0);
+    return 0;
+}
+
+// "S1" and "S0" are what tools/stream_decode.py sends
+static int cmd_stream_on(int argc, char **argv)
+{
+    usb_stream_set_enabled(true);
+    return 0;
+}
+
+static int cmd_stream_off(int argc, char **argv)
+{
+    usb_stream_set_enabled(false);
+    return 0;
+}
+
+static int cmd_save(int argc, char **argv)
+{
+    const power_profile_t *p = power_profile_get(POWER_PROFILE_FULL);
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(TUNABLES_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK)
+    {
+        nvs_set_u8(nvs, "brightness", p->backlight_level);
+        nvs_set_u32(nvs, "refresh_ms", p->refr_period_ms);
+        nvs_set_u16(nvs, "conn_ms", p->conn_interval_ms);
+        nvs_set_u8(nvs, "log_level", default_log_level);
+        ret = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Saving tunables failed: %s", esp_err_to_name(ret));
+        return 1;
+    }
+    ESP_LOGI(TAG, "Saved brightness %d%%, refresh %lu ms, interval %d ms, log level %d",
+             p->backlight_level, p->refr_period_ms, p->conn_interval_ms, default_log_level);
+    return 0;
+}
+
+static void load_tunables(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(TUNABLES_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    uint8_t brightness = 0;
+    uint32_t refresh_ms = 0;
+    uint16_t conn_ms = 0;
+    uint8_t log_level;
+    // keys that were never saved keep the built-in values
+    bool has_brightness = nvs_get_u8(nvs, "brightness", &brightness) == ESP_OK;
+    bool has_refresh = nvs_get_u32(nvs, "refresh_ms", &refresh_ms) == ESP_OK;
+    bool has_conn = nvs_get_u16(nvs, "conn_ms", &conn_ms) == ESP_OK;
+    if (nvs_get_u8(nvs, "log_level", &log_level) == ESP_OK && log_level <= ESP_LOG_VERBOSE)
+    {
+        default_log_level = log_level;
+        esp_log_level_set("*", default_log_level);
+    }
+    nvs_close(nvs);
+    ESP_LOGI(TAG, "Tunables: brightness %d%%, refresh %lu ms, interval %d ms", brightness, refresh_ms, conn_ms);
+    set_tunables(has_brightness ? brightness : POWER_PROFILE_KEEP, has_refresh ? (int32_t)refresh_ms : POWER_PROFILE_KEEP,
+                 has_conn ? conn_ms : POWER_PROFILE_KEEP);
+}
+
+static const esp_console_cmd_t commands[] = {
+    {.command = "stats", .help = "Tasks, heap, frame times and notify latency", .func = cmd_stats},
+    {.command = "mem", .help = "Where the big allocations are, free internal RAM", .func = cmd_mem},
+    {.command = "ble", .help = "State, interval, PDU size and sample rate of the scale links", .func = cmd_ble},
+    {.command = "brightness", .help = "Backlight in percent", .hint = "<1..100>", .func = cmd_brightness},
+    {.command = "refresh", .help = "LVGL refresh period", .hint = "<ms>", .func = cmd_refresh},
+    {.command = "interval", .help = "BLE connection interval, 0 leaves it to the scale", .hint = "<ms>", .func = cmd_interval},
+    {.command = "log", .help = "Log level of a tag, * for all", .hint = "<tag|*> <level>", .func = cmd_log},
+    {.command = "stream", .help = "Binary sample stream", .hint = "<on|off>", .func = cmd_stream},
+    {.command = "S1", .help = "Same as stream on", .func = cmd_stream_on},
+    {.command = "S0", .help = "Same as stream off", .func = cmd_stream_off},
+    {.command = "save", .help = "Keep brightness, refresh, interval and log level in NVS", .func = cmd_save},
+};
+
+void console_init(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    esp_console_config_t config = ESP_CONSOLE_CONFIG_DEFAULT();
+    config.max_cmdline_length = CONSOLE_LINE_MAX;
+    ESP_ERROR_CHECK(esp_console_init(&config));
+    ESP_ERROR_CHECK(esp_console_register_help_command());
+    for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        ESP_ERROR_CHECK(esp_console_cmd_register(&commands[i]));
+    }
+    load_tunables();
+}
+
+// Called by the stream task for every line received from the host
+void console_run_line(char *line)
+{
+    int ret;
+    esp_err_t err = esp_console_run(line, &ret);
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        printf("Unknown command, try help\n");
+    }
+    else if (err == ESP_ERR_INVALID_ARG)
+    {
+        // empty line
+    }
+    else if (err != ESP_OK)
+    {
+        printf("%s\n", esp_err_to_name(err));
+    }
+}
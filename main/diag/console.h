@@ -0,0 +1,5 @@
+#pragma once
+
+void console_init(void);
+void console_run_line(char *line);
+void console_apply_tunables(void);
@@ -0,0 +1,204 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "esp_lvgl_port.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lvgl.h"
+#include "ui/view_diag.h"
+#include "display/wavesharelcd2/display_init.h"
+#include "display/lv_mem_psram.h"
+#include "power/battery_soc.h"
+#include "latency_trace.h"
+#include "diagnostics.h"
+
+static const char *TAG = "diag";
+
+// run time counters of the previous snapshot, to report CPU usage per interval instead of since boot
+static TaskStatus_t task_status[DIAG_MAX_TASKS];
+typedef struct
+{
+    struct
+    {
+        TaskHandle_t handle;
+        configRUN_TIME_COUNTER_TYPE run_time;
+    } tasks[DIAG_MAX_TASKS];
+    int count;
+    configRUN_TIME_COUNTER_TYPE total;
+} diag_baseline_t;
+static diag_baseline_t baselines[DIAG_READER_COUNT];
+
+static diag_snapshot_t snapshot;
+
+_Static_assert(DIAG_READER_COUNT <= LVGL_FRAME_STATS_READERS, "every diag reader needs its own frame statistics");
+
+static configRUN_TIME_COUNTER_TYPE previous_run_time(const diag_baseline_t *base, TaskHandle_t handle)
+{
+    for (int i = 0; i < base->count; i++)
+    {
+        if (base->tasks[i].handle == handle)
+        {
+            return base->tasks[i].run_time;
+        }
+    }
+    return 0;
+}
+
+static void collect_tasks(diag_snapshot_t *snap, diag_baseline_t *base)
+{
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    UBaseType_t count = uxTaskGetSystemState(task_status, DIAG_MAX_TASKS, &total);
+    if (count == 0)
+    {
+        ESP_LOGW(TAG, "More than %d tasks, increase DIAG_MAX_TASKS", DIAG_MAX_TASKS);
+        snap->task_count = 0;
+        return;
+    }
+
+    // the total counts wall time, every core contributes that much run time
+    configRUN_TIME_COUNTER_TYPE elapsed = (total - base->total) * portNUM_PROCESSORS;
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        diag_task_t *t = &snap->tasks[i];
+        strlcpy(t->name, task_status[i].pcTaskName, sizeof(t->name));
+        t->priority = task_status[i].uxCurrentPriority;
+        t->stack_free_bytes = task_status[i].usStackHighWaterMark; // ESP-IDF stacks are counted in bytes
+        configRUN_TIME_COUNTER_TYPE delta = task_status[i].ulRunTimeCounter - previous_run_time(base, task_status[i].xHandle);
+        t->cpu_pct = elapsed > 0 ? (100.0f * delta) / elapsed : 0.0f;
+    }
+    snap->task_count = count;
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        base->tasks[i].handle = task_status[i].xHandle;
+        base->tasks[i].run_time = task_status[i].ulRunTimeCounter;
+    }
+    base->count = count;
+    base->total = total;
+}
+
+static void collect_runtime(diag_snapshot_t *snap)
+{
+    battery_soc_t soc = {0};
+    battery_soc_get(&soc);
+    snap->hours_remaining = soc.hours_remaining;
+    float full = power_profile_projected_hours(POWER_PROFILE_FULL, &soc);
+    for (int i = 0; i < POWER_PROFILE_COUNT; i++)
+    {
+        snap->profile_gain_h[i] = power_profile_projected_hours(i, &soc) - full;
+    }
+}
+
+void diag_collect(diag_snapshot_t *snap, diag_reader_t reader)
+{
+    collect_tasks(snap, &baselines[reader]);
+    collect_runtime(snap);
+
+    snap->internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    snap->internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    snap->internal_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    snap->psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    snap->psram_largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+
+    if (lvgl_port_lock(100))
+    {
+        lv_mem_monitor_t mon;
+        lv_mem_monitor(&mon);
+        lvgl_frame_stats(reader, &snap->frame_count, &snap->frame_avg_us, &snap->frame_max_us, &snap->frame_inv_px);
+        lvgl_port_unlock();
+        snap->lv_total = mon.total_size;
+        snap->lv_free = mon.free_size;
+        snap->lv_largest = mon.free_biggest_size;
+        snap->lv_max_used = mon.max_used;
+        snap->lv_frag_pct = mon.frag_pct;
+    }
+}
+
+void diag_log(const diag_snapshot_t *snap)
+{
+    ESP_LOGI(TAG, "%-16s %3s %6s %10s", "task", "pri", "cpu%", "stack free");
+    for (int i = 0; i < snap->task_count; i++)
+    {
+        const diag_task_t *t = &snap->tasks[i];
+        ESP_LOGI(TAG, "%-16s %3u %6.1f %10lu", t->name, t->priority, t->cpu_pct, t->stack_free_bytes);
+    }
+    ESP_LOGI(TAG, "internal free %u (min %u, largest %u), psram free %u (largest %u)",
+             snap->internal_free, snap->internal_min_free, snap->internal_largest,
+             snap->psram_free, snap->psram_largest);
+    ESP_LOGI(TAG, "lvgl heap free %lu of %lu (largest %lu, max used %lu, frag %u%%)",
+             snap->lv_free, snap->lv_total, snap->lv_largest, snap->lv_max_used, snap->lv_frag_pct);
+    ESP_LOGI(TAG, "%lu frames, render avg %lu us, max %lu us, %lu px invalidated per frame",
+             snap->frame_count, snap->frame_avg_us, snap->frame_max_us, snap->frame_inv_px);
+    ESP_LOGI(TAG, "runtime %.1f h, %s +%.1f h, %s +%.1f h, %s +%.1f h", snap->hours_remaining,
+             power_profile_get(POWER_PROFILE_ECO)->name, snap->profile_gain_h[POWER_PROFILE_ECO],
+             power_profile_get(POWER_PROFILE_SAVER)->name, snap->profile_gain_h[POWER_PROFILE_SAVER],
+             power_profile_get(POWER_PROFILE_CRITICAL)->name, snap->profile_gain_h[POWER_PROFILE_CRITICAL]);
+    latency_trace_log();
+}
+
+static const char *placement(const void *p)
+{
+    if (p == NULL)
+    {
+        return "none";
+    }
+    if (esp_ptr_external_ram(p))
+    {
+        return "psram";
+    }
+    return esp_ptr_dma_capable(p) ? "internal dma" : "internal";
+}
+
+/**
+ * Where the big allocations ended up and what is left of internal RAM. Logged once after
+ * setup, the draw buffers must be internal DMA RAM and the LVGL heap should be all PSRAM.
+ */
+void diag_memory_report(void)
+{
+    const void *buf1, *buf2;
+    size_t buf_bytes;
+    size_t lv_psram, lv_internal;
+    lvgl_port_lock(0);
+    lvgl_draw_buffers(&buf1, &buf2, &buf_bytes);
+    lvgl_port_unlock();
+    lv_mem_psram_usage(&lv_psram, &lv_internal);
+
+    ESP_LOGI(TAG, "draw buffer 1: %u bytes %s", buf_bytes, placement(buf1));
+    ESP_LOGI(TAG, "draw buffer 2: %u bytes %s", buf2 ? buf_bytes : 0, buf2 ? placement(buf2) : "none or not rendered into yet");
+    if (!esp_ptr_dma_capable(buf1) || (buf2 != NULL && !esp_ptr_dma_capable(buf2)))
+    {
+        ESP_LOGW(TAG, "draw buffers are not DMA capable, every flush is copied");
+    }
+    ESP_LOGI(TAG, "lvgl heap: %u bytes psram, %u bytes internal", lv_psram, lv_internal);
+    if (lv_internal > 0)
+    {
+        ESP_LOGW(TAG, "lvgl heap fell back to internal RAM");
+    }
+    ESP_LOGI(TAG, "internal free %u (largest %u), dma free %u, psram free %u",
+             heap_caps_get_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+             heap_caps_get_free_size(MALLOC_CAP_DMA), heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+}
+
+/**
+ * Take a snapshot if anybody is interested in it: the log when requested, or the
+ * diagnostics screen while it is shown.
+ */
+void diag_update(bool log)
+{
+    bool screen = view_diag_active();
+    if (!log && !screen)
+    {
+        return;
+    }
+    if (log)
+    {
+        diag_collect(&snapshot, DIAG_READER_LOG);
+        diag_log(&snapshot);
+    }
+    if (screen)
+    {
+        diag_collect(&snapshot, DIAG_READER_SCREEN);
+        view_diag_update(&snapshot);
+    }
+}
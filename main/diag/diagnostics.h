@@ -0,0 +1,58 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "power/power_profile.h"
+
+#define DIAG_MAX_TASKS 24
+
+// Consumers of the snapshots. Each one gets deltas since its own previous snapshot, so the
+// diagnostics screen refreshing every second does not shorten the interval of the log.
+typedef enum
+{
+    DIAG_READER_LOG,
+    DIAG_READER_SCREEN,
+    DIAG_READER_COUNT,
+} diag_reader_t;
+
+typedef struct
+{
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    float cpu_pct;             // share of total run time since the reader's previous snapshot
+    uint32_t stack_free_bytes; // stack high-water mark, bytes never used so far
+} diag_task_t;
+
+typedef struct
+{
+    diag_task_t tasks[DIAG_MAX_TASKS];
+    int task_count;
+
+    size_t internal_free;
+    size_t internal_largest;
+    size_t internal_min_free;
+    size_t psram_free;
+    size_t psram_largest;
+
+    uint32_t lv_total;
+    uint32_t lv_free;
+    uint32_t lv_largest;
+    uint32_t lv_max_used;
+    uint8_t lv_frag_pct;
+
+    // frames rendered since the reader's previous snapshot
+    uint32_t frame_count;
+    uint32_t frame_avg_us;
+    uint32_t frame_max_us;
+    uint32_t frame_inv_px;  // average pixels invalidated per frame
+
+    // battery runtime at the current load, and what each lower profile would add to it
+    float hours_remaining;
+    float profile_gain_h[POWER_PROFILE_COUNT];
+} diag_snapshot_t;
+
+void diag_collect(diag_snapshot_t *snap, diag_reader_t reader);
+void diag_log(const diag_snapshot_t *snap);
+void diag_update(bool log);
+void diag_memory_report(void);
@@ -0,0 +1,139 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "dlog.h"
+
+// Bounded multi producer ring. Every slot carries a sequence number: a producer claims a
+// position with a compare and swap on head and publishes the slot by setting its sequence
+// to position + 1. The printer task is the only consumer, it frees a slot by setting the
+// sequence to position + DLOG_RING_SIZE. Nobody takes a lock or waits, a full ring drops
+// the record and counts it.
+
+#define DLOG_RING_SIZE 64 // power of two
+#define DLOG_LINE_MAX 160
+#define DLOG_TASK_STACK (1024 * 3)
+#define DLOG_TASK_PRIORITY 1
+
+typedef struct
+{
+    atomic_uint seq;
+    uint32_t time_ms;
+    const char *tag;
+    const char *format;
+    uint8_t level;
+    uint8_t nargs;
+    uint32_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+static const char *TAG = "dlog";
+
+static dlog_record_t ring[DLOG_RING_SIZE];
+static atomic_uint head = 0;
+static uint32_t tail = 0; // printer task only
+static atomic_uint dropped = 0;
+static atomic_bool printer_idle = false;
+static TaskHandle_t printer = NULL;
+
+void dlog_write(esp_log_level_t level, const char *tag, const char *format, int nargs, ...)
+{
+    if (printer == NULL)
+    {
+        return;
+    }
+    unsigned pos = atomic_load_explicit(&head, memory_order_relaxed);
+    dlog_record_t *r;
+    while (1)
+    {
+        r = &ring[pos & (DLOG_RING_SIZE - 1)];
+        int diff = (int)(atomic_load_explicit(&r->seq, memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+        }
+    }
+
+    r->time_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    r->tag = tag;
+    r->format = format;
+    r->level = level;
+    r->nargs = nargs;
+    va_list ap;
+    va_start(ap, nargs);
+    for (int i = 0; i < nargs && i < DLOG_MAX_ARGS; i++)
+    {
+        r->args[i] = va_arg(ap, uint32_t);
+    }
+    va_end(ap);
+    atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+
+    // only the first record after the printer went to sleep pays for waking it
+    if (atomic_exchange(&printer_idle, false))
+    {
+        xTaskNotifyGive(printer);
+    }
+}
+
+static bool print_one(void)
+{
+    static char line[DLOG_LINE_MAX];
+    static const char letters[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+    dlog_record_t *r = &ring[tail & (DLOG_RING_SIZE - 1)];
+    if (atomic_load_explicit(&r->seq, memory_order_acquire) != tail + 1)
+    {
+        return false;
+    }
+    // surplus arguments are ignored by printf
+    const uint32_t *a = r->args;
+    snprintf(line, sizeof(line), r->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+    esp_log_write(r->level, r->tag, "%c (%lu) %s: %s\n", letters[r->level], r->time_ms, r->tag, line);
+    atomic_store_explicit(&r->seq, tail + DLOG_RING_SIZE, memory_order_release);
+    tail++;
+    return true;
+}
+
+static void printer_task(void *params)
+{
+    while (1)
+    {
+        while (print_one())
+        {
+        }
+        unsigned lost = atomic_exchange(&dropped, 0);
+        if (lost > 0)
+        {
+            ESP_LOGW(TAG, "%u log records dropped", lost);
+        }
+        atomic_store(&printer_idle, true);
+        // a record published before the flag was set did not wake us, look once more
+        if (print_one())
+        {
+            atomic_store(&printer_idle, false);
+            continue;
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+void dlog_init(void)
+{
+    for (unsigned i = 0; i < DLOG_RING_SIZE; i++)
+    {
+        atomic_init(&ring[i].seq, i);
+    }
+    xTaskCreatePinnedToCore(printer_task, "dlog_task", DLOG_TASK_STACK, NULL, DLOG_TASK_PRIORITY, &printer, 1);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include "esp_log.h"
+
+// Deferred logging for the BLE callbacks and touch handlers.
+//
+// DLOGI and friends only store the format pointer and up to DLOG_MAX_ARGS raw 32 bit arguments
+// in a ring, formatting and UART output happen later on a low priority task. The output looks
+// like ESP_LOGx output, stamped with the time the record was made.
+//
+// Restrictions, because the arguments are copied as 32 bit words and formatted later:
+// - the format must be a string literal
+// - arguments are int, unsigned, char or pointer sized; no float, no 64 bit values
+// - %s only for strings that outlive the record: literals, const tables, driver names
+// - task context only
+// Errors stay on ESP_LOGE, they are rare and should not be lost if the ring is full.
+
+#define DLOG_MAX_ARGS 6
+
+#define DLOG_ARGN(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+#define DLOG_NARGS(...) DLOG_ARGN(_0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+#define DLOG_LEVEL(level, tag, format, ...)                                                  \
+    do                                                                                      \
+    {                                                                                       \
+        if (LOG_LOCAL_LEVEL >= level)                                                       \
+        {                                                                                   \
+            dlog_write(level, tag, format, DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);          \
+        }                                                                                   \
+    } while (0)
+
+#define DLOGW(tag, format, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) DLOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+void dlog_init(void);
+void dlog_write(esp_log_level_t level, const char *tag, const char *format, int nargs, ...);
@@ -0,0 +1,187 @@
+#include <stdbool.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "latency_trace.h"
+
+// Latency trace from BLE notify to pixels on the panel.
+//
+// Every notification opens a record in a preallocated ring. The later stages stamp the record of
+// the sample that is currently travelling through the pipeline. Stamps are taken from the
+// systimer via esp_timer_get_time(): the stages run on both cores and the CPU cycle counters
+// of the two cores are not synchronized.
+//
+// The trace points take no locks. A record that is overwritten while being summarized is
+// detected through its sequence number and skipped.
+
+#define TRACE_RING_SIZE 128
+
+typedef struct
+{
+    volatile uint32_t seq;
+    volatile uint32_t t_us[TRACE_STAGE_COUNT];
+} trace_record_t;
+
+static const char *TAG = "latency";
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {"total", "consume", "invalidate", "render", "flush"};
+
+static trace_record_t ring[TRACE_RING_SIZE];
+static volatile uint32_t notify_seq = 0;
+static volatile uint32_t consumed_seq = 0;
+static volatile uint32_t render_seq = 0;
+static volatile uint32_t flush_seq = 0;
+
+// Longest time between two notifications. The GATT callback runs on the Bluedroid task on core 0,
+// a gap well above the scale's sample period means that task did not get the CPU in time.
+static volatile uint32_t last_notify_us = 0;
+static volatile uint32_t max_notify_gap_us = 0;
+
+static inline uint32_t IRAM_ATTR now_us(void)
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+// Stamp a stage once, the first time the sample reaches it
+static inline bool IRAM_ATTR stamp(uint32_t seq, trace_stage_t stage)
+{
+    trace_record_t *r = &ring[seq % TRACE_RING_SIZE];
+    if (seq != 0 && r->seq == seq && r->t_us[stage] == 0)
+    {
+        r->t_us[stage] = now_us();
+        return true;
+    }
+    return false;
+}
+
+void latency_trace_notify(void)
+{
+    uint32_t seq = notify_seq + 1;
+    trace_record_t *r = &ring[seq % TRACE_RING_SIZE];
+    r->seq = 0; // invalidate while the stamps are reset
+    for (int i = 1; i < TRACE_STAGE_COUNT; i++)
+    {
+        r->t_us[i] = 0;
+    }
+    uint32_t t = now_us();
+    r->t_us[TRACE_NOTIFY] = t;
+    r->seq = seq;
+    notify_seq = seq;
+
+    if (last_notify_us != 0 && t - last_notify_us > max_notify_gap_us)
+    {
+        max_notify_gap_us = t - last_notify_us;
+    }
+    last_notify_us = t;
+}
+
+void latency_trace_consumed(void)
+{
+    consumed_seq = notify_seq;
+    stamp(consumed_seq, TRACE_CONSUMED);
+}
+
+void latency_trace_invalidated(void)
+{
+    stamp(consumed_seq, TRACE_INVALIDATED);
+    render_seq = consumed_seq;
+}
+
+// Only the first frame after the invalidation carries the sample. Frames that only redraw the
+// timer or the battery must not move the flush stamp of the last weight record.
+void latency_trace_render_start(void)
+{
+    uint32_t seq = render_seq;
+    render_seq = 0;
+    flush_seq = stamp(seq, TRACE_RENDER_START) ? seq : 0;
+}
+
+// Called from the SPI transaction-done ISR for every strip. The stamp is kept up to date
+// so the record ends up with the completion time of the last strip of the frame.
+void IRAM_ATTR latency_trace_flush_done(void)
+{
+    uint32_t seq = flush_seq;
+    trace_record_t *r = &ring[seq % TRACE_RING_SIZE];
+    if (seq != 0 && r->seq == seq && r->t_us[TRACE_RENDER_START] != 0)
+    {
+        r->t_us[TRACE_FLUSH_DONE] = now_us();
+    }
+}
+
+static void sort(uint32_t *values, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        uint32_t v = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > v)
+        {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = v;
+    }
+}
+
+static uint32_t percentile(const uint32_t *sorted, int count, int pct)
+{
+    return count == 0 ? 0 : sorted[(count - 1) * pct / 100];
+}
+
+// Copies a complete record, returns false for empty, unfinished or concurrently reused slots
+static bool read_record(int index, uint32_t newest, trace_record_t *out)
+{
+    uint32_t seq = ring[index].seq;
+    memcpy(out, (const void *)&ring[index], sizeof(*out));
+    // the newest record may still be collecting flush stamps
+    return seq != 0 && out->seq == seq && seq != newest && out->t_us[TRACE_FLUSH_DONE] != 0;
+}
+
+void latency_trace_summary(latency_stats_t stats[TRACE_STAGE_COUNT])
+{
+    uint32_t deltas[TRACE_RING_SIZE];
+    uint32_t newest = notify_seq;
+
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++)
+    {
+        int count = 0;
+        for (int i = 0; i < TRACE_RING_SIZE; i++)
+        {
+            trace_record_t r;
+            if (read_record(i, newest, &r))
+            {
+                deltas[count++] = s == 0 ? r.t_us[TRACE_FLUSH_DONE] - r.t_us[TRACE_NOTIFY] : r.t_us[s] - r.t_us[s - 1];
+            }
+        }
+        sort(deltas, count);
+        stats[s].count = count;
+        stats[s].p50_us = percentile(deltas, count, 50);
+        stats[s].p95_us = percentile(deltas, count, 95);
+        stats[s].p99_us = percentile(deltas, count, 99);
+    }
+}
+
+// Returns the longest gap since the previous call
+uint32_t latency_trace_max_notify_gap_us(void)
+{
+    uint32_t gap = max_notify_gap_us;
+    max_notify_gap_us = 0;
+    return gap;
+}
+
+void latency_trace_log(void)
+{
+    latency_stats_t stats[TRACE_STAGE_COUNT];
+    latency_trace_summary(stats);
+    if (stats[0].count == 0)
+    {
+        return;
+    }
+    ESP_LOGI(TAG, "longest gap between notifications %lu us", latency_trace_max_notify_gap_us());
+    ESP_LOGI(TAG, "%-10s %8s %8s %8s (us, %lu samples)", "stage", "p50", "p95", "p99", stats[0].count);
+    for (int s = 0; s < TRACE_STAGE_COUNT; s++)
+    {
+        ESP_LOGI(TAG, "%-10s %8lu %8lu %8lu", stage_names[s], stats[s].p50_us, stats[s].p95_us, stats[s].p99_us);
+    }
+}
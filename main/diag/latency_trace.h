@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+// Stages a weight sample passes on its way from the scale to the panel
+typedef enum
+{
+    TRACE_NOTIFY,       // notification received in the GATT client callback
+    TRACE_CONSUMED,     // sample picked up by the weight controller
+    TRACE_INVALIDATED,  // weight label text changed, area invalidated
+    TRACE_RENDER_START, // LVGL started rendering the invalidated areas
+    TRACE_FLUSH_DONE,   // SPI transfer of the last flushed strip completed
+    TRACE_STAGE_COUNT,
+} trace_stage_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t p50_us;
+    uint32_t p95_us;
+    uint32_t p99_us;
+} latency_stats_t;
+
+void latency_trace_notify(void);
+void latency_trace_consumed(void);
+void latency_trace_invalidated(void);
+void latency_trace_render_start(void);
+void latency_trace_flush_done(void);
+
+// stats[0] is notify to flush done, stats[s] is the time from stage s-1 to stage s
+void latency_trace_summary(latency_stats_t stats[TRACE_STAGE_COUNT]);
+uint32_t latency_trace_max_notify_gap_us(void);
+void latency_trace_log(void);
@@ -0,0 +1,130 @@
+#include "lvgl.h"
+
+#if LV_USE_STDLIB_MALLOC == LV_STDLIB_CUSTOM
+
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "freertos/FreeRTOS.h"
+#include "lv_mem_psram.h"
+
+// LVGL heap for objects, styles, glyph and image caches and draw layers. It lives in PSRAM and
+// grows with the PSRAM heap instead of a fixed 48 KB pool in internal RAM. When PSRAM is full
+// the allocation falls back to internal RAM, and the fallback bytes are counted separately so the
+// memory report shows it.
+// The draw buffers are not allocated here, esp_lvgl_port takes them from internal DMA capable RAM.
+
+#define LV_MEM_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#define LV_MEM_FALLBACK_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+
+static portMUX_TYPE mem_mux = portMUX_INITIALIZER_UNLOCKED;
+static size_t used_psram = 0;
+static size_t used_internal = 0;
+static size_t max_used = 0;
+static uint32_t used_cnt = 0;
+
+static void account(void *p, bool add)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    size_t size = heap_caps_get_allocated_size(p);
+    bool psram = esp_ptr_external_ram(p);
+    taskENTER_CRITICAL(&mem_mux);
+    if (add)
+    {
+        *(psram ? &used_psram : &used_internal) += size;
+        used_cnt++;
+        if (used_psram + used_internal > max_used)
+        {
+            max_used = used_psram + used_internal;
+        }
+    }
+    else
+    {
+        *(psram ? &used_psram : &used_internal) -= size;
+        used_cnt--;
+    }
+    taskEXIT_CRITICAL(&mem_mux);
+}
+
+void lv_mem_init(void)
+{
+}
+
+void lv_mem_deinit(void)
+{
+}
+
+lv_mem_pool_t lv_mem_add_pool(void *mem, size_t bytes)
+{
+    // the PSRAM heap is the pool
+    return NULL;
+}
+
+void lv_mem_remove_pool(lv_mem_pool_t pool)
+{
+}
+
+void *lv_malloc_core(size_t size)
+{
+    void *p = heap_caps_malloc(size, LV_MEM_CAPS);
+    if (p == NULL)
+    {
+        p = heap_caps_malloc(size, LV_MEM_FALLBACK_CAPS);
+    }
+    account(p, true);
+    return p;
+}
+
+void *lv_realloc_core(void *p, size_t new_size)
+{
+    account(p, false);
+    void *q = heap_caps_realloc(p, new_size, LV_MEM_CAPS);
+    if (q == NULL && new_size > 0)
+    {
+        q = heap_caps_realloc(p, new_size, LV_MEM_FALLBACK_CAPS);
+    }
+    // a failed realloc leaves the old block in place
+    account(q != NULL || new_size == 0 ? q : p, true);
+    return q;
+}
+
+void lv_free_core(void *p)
+{
+    account(p, false);
+    heap_caps_free(p);
+}
+
+// Total and free are those of the PSRAM heap, nothing else in this app allocates from it
+void lv_mem_monitor_core(lv_mem_monitor_t *mon_p)
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, LV_MEM_CAPS);
+    taskENTER_CRITICAL(&mem_mux);
+    size_t used = used_psram + used_internal;
+    mon_p->used_cnt = used_cnt;
+    mon_p->max_used = max_used;
+    taskEXIT_CRITICAL(&mem_mux);
+    mon_p->total_size = info.total_free_bytes + info.total_allocated_bytes;
+    mon_p->free_size = info.total_free_bytes;
+    mon_p->free_biggest_size = info.largest_free_block;
+    mon_p->free_cnt = info.free_blocks;
+    mon_p->used_pct = mon_p->total_size ? (uint8_t)(100 * used / mon_p->total_size) : 0;
+    mon_p->frag_pct = info.total_free_bytes ? (uint8_t)(100 - 100 * info.largest_free_block / info.total_free_bytes) : 0;
+}
+
+lv_result_t lv_mem_test_core(void)
+{
+    return heap_caps_check_integrity(LV_MEM_CAPS, false) ? LV_RESULT_OK : LV_RESULT_INVALID;
+}
+
+void lv_mem_psram_usage(size_t *psram, size_t *internal)
+{
+    taskENTER_CRITICAL(&mem_mux);
+    *psram = used_psram;
+    *internal = used_internal;
+    taskEXIT_CRITICAL(&mem_mux);
+}
+
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+#include <stddef.h>
+
+// Bytes LVGL currently holds in PSRAM and, after PSRAM ran out, in internal RAM
+void lv_mem_psram_usage(size_t *psram, size_t *internal);
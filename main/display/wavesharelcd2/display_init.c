@@ -20,6 +20,7 @@
 #include "esp_log.h"
 #include "esp_check.h"
 #include "esp_heap_caps.h"
+#include "diag/latency_trace.h"
 
 #define GPIO_PIN_NUM_SCLK 39
 #define GPIO_PIN_NUM_MOSI 38
@@ -53,8 +54,8 @@
 #define LCD_BL_LEDC_DUTY (1024)
 #define LCD_BL_LEDC_FREQUENCY (10000)
 
-// Buffer size - use 1/8 of screen for better stability
-#define LVGL_BUFFER_SIZE (LCD_H_RES * LCD_V_RES / 8)
+// Draw buffers in pixels, a quarter of the screen each. They are taken from internal DMA capable RAM.
+#define LVGL_BUFFER_SIZE (LCD_H_RES * LCD_V_RES / 4)
 #define EXAMPLE_LCD_DRAW_BUFF_DOUBLE (1)
 #define EXAMPLE_LCD_DRAW_BUFF_HEIGHT (50)
 #define EXAMPLE_LCD_BL_ON_LEVEL (1)
@@ -73,6 +74,8 @@ static i2c_master_bus_handle_t i2c_bus_handle;
 static lv_display_t *lvgl_disp = NULL;
 static lv_indev_t *lvgl_touch_indev = NULL;
 
+static uint8_t brightness_level = 0;
+
 void display_init(void)
 {
     ESP_LOGI(TAG, "Initialize SPI bus");
@@ -162,6 +165,94 @@ void touch_init(void)
     ESP_LOGI(TAG, "Touch controller initialized");
 }
 
+// Rendering is split across one software draw unit per core
+#if LV_USE_OS != LV_OS_FREERTOS || LV_DRAW_SW_DRAW_UNIT_CNT < 2
+#warning "LVGL renders on a single thread, enable CONFIG_LV_OS_FREERTOS and two draw units"
+#endif
+
+// Frame time from render start to the last area handed to the flush, for comparing draw unit setups,
+// and the pixels invalidated for the frame, for checking how much a label update redraws.
+// Every reader has its own accumulator, so reading the statistics does not reset them for the others.
+static int64_t frame_start_us = 0;
+static uint32_t pending_inv_px = 0;
+static uint32_t frame_inv_px = 0;
+static struct
+{
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint64_t inv_px;
+} frame_stats[LVGL_FRAME_STATS_READERS];
+
+// Areas are counted as LVGL reports them, before it joins overlapping ones
+static void invalidate_area_cb(lv_event_t *e)
+{
+    const lv_area_t *area = lv_event_get_param(e);
+    pending_inv_px += lv_area_get_size(area);
+}
+
+// esp_lvgl_port allocates the draw buffers and LVGL has no getter for both of them, so every buffer
+// LVGL renders into is remembered. They swap after every strip, so the second one shows up with the
+// first frame that ends on it.
+static const lv_draw_buf_t *draw_bufs[2];
+
+static void note_draw_buf(void)
+{
+    const lv_draw_buf_t *buf = lv_display_get_buf_active(lvgl_disp);
+    if (buf == NULL || buf == draw_bufs[0] || buf == draw_bufs[1])
+    {
+        return;
+    }
+    draw_bufs[draw_bufs[0] == NULL ? 0 : 1] = buf;
+}
+
+static void render_start_cb(lv_event_t *e)
+{
+    latency_trace_render_start();
+    note_draw_buf();
+    frame_start_us = esp_timer_get_time();
+    frame_inv_px = pending_inv_px;
+    pending_inv_px = 0;
+}
+
+static void render_ready_cb(lv_event_t *e)
+{
+    uint32_t t = (uint32_t)(esp_timer_get_time() - frame_start_us);
+    note_draw_buf();
+    for (int i = 0; i < LVGL_FRAME_STATS_READERS; i++)
+    {
+        frame_stats[i].count++;
+        frame_stats[i].sum_us += t;
+        frame_stats[i].inv_px += frame_inv_px;
+        if (t > frame_stats[i].max_us)
+        {
+            frame_stats[i].max_us = t;
+        }
+    }
+}
+
+// Called with the LVGL lock held, resets the statistics of this reader
+void lvgl_frame_stats(int reader, uint32_t *frames, uint32_t *avg_us, uint32_t *max_us, uint32_t *avg_inv_px)
+{
+    *frames = frame_stats[reader].count;
+    *avg_us = frame_stats[reader].count ? (uint32_t)(frame_stats[reader].sum_us / frame_stats[reader].count) : 0;
+    *max_us = frame_stats[reader].max_us;
+    *avg_inv_px = frame_stats[reader].count ? (uint32_t)(frame_stats[reader].inv_px / frame_stats[reader].count) : 0;
+    frame_stats[reader].count = 0;
+    frame_stats[reader].sum_us = 0;
+    frame_stats[reader].max_us = 0;
+    frame_stats[reader].inv_px = 0;
+}
+
+// Replaces the transfer-done callback esp_lvgl_port registers, which only signals flush ready,
+// so the completion of every SPI strip can be traced
+static bool IRAM_ATTR color_trans_done_cb(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_io_event_data_t *edata, void *user_ctx)
+{
+    latency_trace_flush_done();
+    lv_display_flush_ready((lv_display_t *)user_ctx);
+    return false;
+}
+
 esp_err_t lvgl_init(void)
 {
     /* Initialize LVGL */
@@ -179,7 +270,7 @@ esp_err_t lvgl_init(void)
     const lvgl_port_display_cfg_t disp_cfg = {
         .io_handle = io_handle,
         .panel_handle = panel_handle,
-        .buffer_size = LVGL_BUFFER_SIZE * sizeof(lv_color_t),
+        .buffer_size = LVGL_BUFFER_SIZE,
         .double_buffer = EXAMPLE_LCD_DRAW_BUFF_DOUBLE,
         .hres = LCD_H_RES,
         .vres = LCD_V_RES,
@@ -192,10 +283,20 @@ esp_err_t lvgl_init(void)
         },
         .flags = {
             .buff_dma = true,
+            .buff_spiram = false,
             .swap_bytes = true,
         }};
     lvgl_disp = lvgl_port_add_disp(&disp_cfg);
 
+    const esp_lcd_panel_io_callbacks_t io_cbs = {
+        .on_color_trans_done = color_trans_done_cb,
+    };
+    ESP_RETURN_ON_ERROR(esp_lcd_panel_io_register_event_callbacks(io_handle, &io_cbs, lvgl_disp), TAG, "Register flush callback failed");
+    lv_display_add_event_cb(lvgl_disp, invalidate_area_cb, LV_EVENT_INVALIDATE_AREA, NULL);
+    lv_display_add_event_cb(lvgl_disp, render_start_cb, LV_EVENT_RENDER_START, NULL);
+    lv_display_add_event_cb(lvgl_disp, render_ready_cb, LV_EVENT_RENDER_READY, NULL);
+    ESP_LOGI(TAG, "LVGL software draw units: %d", LV_DRAW_SW_DRAW_UNIT_CNT);
+
     /* Add touch input (for selected screen) */
     const lvgl_port_touch_cfg_t touch_cfg = {
         .disp = lvgl_disp,
@@ -206,6 +307,28 @@ esp_err_t lvgl_init(void)
     return ESP_OK;
 }
 
+// Called with the LVGL lock held. buf2 stays NULL until LVGL has rendered into it.
+void lvgl_draw_buffers(const void **buf1, const void **buf2, size_t *bytes)
+{
+    note_draw_buf();
+    *buf1 = draw_bufs[0] ? draw_bufs[0]->data : NULL;
+    *buf2 = draw_bufs[1] ? draw_bufs[1]->data : NULL;
+    *bytes = draw_bufs[0] ? draw_bufs[0]->data_size : 0;
+}
+
+void lvgl_set_refresh_period(uint32_t period_ms)
+{
+    if (lvgl_port_lock(1000))
+    {
+        lv_timer_t *refr_timer = lv_display_get_refr_timer(lvgl_disp);
+        if (refr_timer != NULL)
+        {
+            lv_timer_set_period(refr_timer, period_ms);
+        }
+        lvgl_port_unlock();
+    }
+}
+
 void bsp_brightness_init(void)
 {
     ESP_LOGI(TAG, "Initialize backlight");
@@ -243,10 +366,16 @@ void bsp_brightness_set_level(uint8_t level)
     uint32_t duty = (level * (LCD_BL_LEDC_DUTY - 1)) / 100;
     ESP_ERROR_CHECK(ledc_set_duty(LCD_BL_LEDC_MODE, LCD_BL_LEDC_CHANNEL, duty));
     ESP_ERROR_CHECK(ledc_update_duty(LCD_BL_LEDC_MODE, LCD_BL_LEDC_CHANNEL));
+    brightness_level = level;
 
     ESP_LOGI(TAG, "Brightness set to %d%%", level);
 }
 
+uint8_t bsp_brightness_get_level(void)
+{
+    return brightness_level;
+}
+
 void lcd_off()
 {
     // esp_lcd_panel_disp_on_off(panel_handle, false);
@@ -1,13 +1,20 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include "lvgl.h"
 #include "esp_err.h"
 
+#define LVGL_FRAME_STATS_READERS 2
+
 
 
 void display_init(void);
 void touch_init(void);
 esp_err_t lvgl_init(void);
+void lvgl_set_refresh_period(uint32_t period_ms);
+void lvgl_frame_stats(int reader, uint32_t *frames, uint32_t *avg_us, uint32_t *max_us, uint32_t *avg_inv_px);
+void lvgl_draw_buffers(const void **buf1, const void **buf2, size_t *bytes);
 void bsp_brightness_init(void);
 void bsp_brightness_set_level(uint8_t);
+uint8_t bsp_brightness_get_level(void);
 void lcd_off();
\ No newline at end of file
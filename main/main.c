@@ -9,6 +9,12 @@
 #include "ui/controller/battery_ctrl.h"
 #include "ui/controller/timer_ctrl.h"
 #include "ui/controller/scale_ctrl.h"
+#include "ui/controller/app_ctrl.h"
+#include "diag/diagnostics.h"
+#include "diag/dlog.h"
+#include "diag/console.h"
+#include "shot/shot_log.h"
+#include "stream/usb_stream.h"
 
 #define CST816D_INT_PIN 5
 
@@ -16,6 +22,9 @@ static const char *TAG = "scalectrl";
 
 void app_main(void)
 {
+    // Log records from the BLE and touch paths are printed by the dlog task
+    dlog_init();
+
     // Initialize hardware
     display_init();
     touch_init();
@@ -28,25 +37,19 @@ void app_main(void)
     // Create UI
     make_widget_tree();
     battery_init();
+    shot_log_init();
+    usb_stream_init();
 
     esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
     ESP_LOGI(TAG, "Wakeup Cause: %d", wakeup_cause);
 
-    // Start weight collection task
-    xTaskCreatePinnedToCore(collect_weight_task, "collect_weight_task", 1024 * 2, NULL, 5, NULL, 1);
-
-    // Start timer task
-    xTaskCreatePinnedToCore(timer_task, "timer_task", 1024 * 3, NULL, 5, NULL, 1);
+    // Weight, timer, battery and diagnostics all run on the controller task
+    app_ctrl_start();
 
-    // Start battery task
-    xTaskCreatePinnedToCore(check_battery_task, "check_battery_task", 1024 * 2, NULL, 5, NULL, 1);
+    // Commands and saved tunables, the shell reads from the stream port
+    console_init();
 
     ESP_LOGI(TAG, "Setup complete");
-
-    // Monitor loop
-    while (1)
-    {
-        vTaskDelay(pdMS_TO_TICKS(10000));
-        ESP_LOGI(TAG, "Free heap: %lu bytes", esp_get_free_heap_size());
-    }
+    diag_memory_report();
+    // returning ends the main task and frees its stack
 }
\ No newline at end of file
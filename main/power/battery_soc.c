@@ -0,0 +1,137 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "display/wavesharelcd2/display_init.h"
+#include "scale/ble.h"
+#include "battery_soc.h"
+
+// Capacity of the cell built into the case
+#define BATTERY_CAPACITY_MAH 2000.0f
+
+// Cell internal resistance plus protection circuit and wiring
+#define BATTERY_INTERNAL_RESISTANCE_OHM 0.15f
+
+// Load model in mA, estimated from the ESP32-S3, ST7789 and backlight LED datasheets
+#define LOAD_BASE_MA 12.0f              // PMU, LCD controller, touch controller
+#define LOAD_CPU_MA_PER_MHZ 0.16f       // both cores active at 240 MHz = ~38 mA
+#define LOAD_BACKLIGHT_MA_AT_FULL 60.0f // scales linearly with the PWM duty
+#define LOAD_BLE_CONNECTED_MA 9.0f      // radio on for each connection event
+#define LOAD_BLE_REF_INTERVAL_MS 30     // connection interval LOAD_BLE_CONNECTED_MA refers to
+#define LOAD_BLE_SCAN_RX_MA 80.0f       // radio receiving during the scan window
+
+// Time constant of the SoC smoothing, keeps the display from following short load spikes
+#define SOC_TAU_S 300.0f
+
+static const char *TAG = "battery_soc";
+
+// LiPo open-circuit voltage per 5% step of state of charge (index 0 = 0%, index 20 = 100%)
+static const float ocv_table[] = {
+    3.27f, 3.61f, 3.69f, 3.71f, 3.73f, 3.75f, 3.77f, 3.79f, 3.80f, 3.82f, 3.84f,
+    3.85f, 3.87f, 3.91f, 3.95f, 3.98f, 4.02f, 4.08f, 4.11f, 4.15f, 4.20f};
+#define OCV_TABLE_SIZE (sizeof(ocv_table) / sizeof(ocv_table[0]))
+#define OCV_TABLE_STEP_PCT (100.0f / (OCV_TABLE_SIZE - 1))
+
+static SemaphoreHandle_t soc_mutex = NULL;
+static battery_soc_t soc_state = {0};
+static int64_t last_update_us = 0;
+
+void battery_soc_init(void)
+{
+    if (soc_mutex == NULL)
+    {
+        soc_mutex = xSemaphoreCreateMutex();
+    }
+}
+
+void battery_soc_current_load(battery_load_t *load)
+{
+    load->backlight_level = bsp_brightness_get_level();
+    load->ble_connected = scale_is_connected();
+    load->ble_conn_interval_ms = scale_get_conn_interval_ms();
+    load->ble_scan_duty_pct = scale_get_scan_duty_pct();
+    load->cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+}
+
+float battery_soc_load_ma(const battery_load_t *load)
+{
+    float ma = LOAD_BASE_MA;
+    ma += LOAD_CPU_MA_PER_MHZ * load->cpu_mhz;
+    ma += LOAD_BACKLIGHT_MA_AT_FULL * load->backlight_level / 100.0f;
+    if (load->ble_connected)
+    {
+        // radio on-time is per connection event, so the current scales with the event rate
+        uint16_t interval = load->ble_conn_interval_ms ? load->ble_conn_interval_ms : LOAD_BLE_REF_INTERVAL_MS;
+        ma += LOAD_BLE_CONNECTED_MA * LOAD_BLE_REF_INTERVAL_MS / interval;
+    }
+    ma += LOAD_BLE_SCAN_RX_MA * load->ble_scan_duty_pct / 100.0f;
+    return ma;
+}
+
+float battery_soc_ocv_to_percent(float ocv)
+{
+    if (ocv <= ocv_table[0])
+    {
+        return 0.0f;
+    }
+    if (ocv >= ocv_table[OCV_TABLE_SIZE - 1])
+    {
+        return 100.0f;
+    }
+    // The table is short, a linear search is cheaper than bisecting
+    int i = 1;
+    while (ocv > ocv_table[i])
+    {
+        i++;
+    }
+    float fraction = (ocv - ocv_table[i - 1]) / (ocv_table[i] - ocv_table[i - 1]);
+    return ((i - 1) + fraction) * OCV_TABLE_STEP_PCT;
+}
+
+float battery_soc_hours_at(float percent, float load_ma)
+{
+    return (BATTERY_CAPACITY_MAH * percent / 100.0f) / load_ma;
+}
+
+void battery_soc_update(float voltage)
+{
+    battery_load_t load;
+    battery_soc_current_load(&load);
+
+    float load_ma = battery_soc_load_ma(&load);
+    float ocv = voltage + (load_ma / 1000.0f) * BATTERY_INTERNAL_RESISTANCE_OHM;
+    float percent = battery_soc_ocv_to_percent(ocv);
+    int64_t now = esp_timer_get_time();
+
+    battery_soc_init();
+    if (xSemaphoreTake(soc_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+    {
+        if (last_update_us == 0)
+        {
+            soc_state.percent = percent;
+        }
+        else
+        {
+            float dt = (now - last_update_us) / 1000000.0f;
+            soc_state.percent += (dt / (SOC_TAU_S + dt)) * (percent - soc_state.percent);
+        }
+        last_update_us = now;
+        soc_state.voltage = voltage;
+        soc_state.ocv = ocv;
+        soc_state.load_ma = load_ma;
+        soc_state.hours_remaining = battery_soc_hours_at(soc_state.percent, load_ma);
+        xSemaphoreGive(soc_mutex);
+    }
+    ESP_LOGD(TAG, "V %.3f, OCV %.3f, load %.0f mA, SoC %.1f%%", voltage, ocv, load_ma, percent);
+}
+
+void battery_soc_get(battery_soc_t *soc)
+{
+    battery_soc_init();
+    if (xSemaphoreTake(soc_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+    {
+        *soc = soc_state;
+        xSemaphoreGive(soc_mutex);
+    }
+}
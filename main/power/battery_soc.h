@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Known consumers that make the terminal voltage sag below the open-circuit voltage
+typedef struct
+{
+    uint8_t backlight_level; // 0..100 as passed to bsp_brightness_set_level
+    bool ble_connected;
+    uint16_t ble_conn_interval_ms;
+    uint8_t ble_scan_duty_pct; // share of the time the radio listens while scanning
+    uint32_t cpu_mhz;
+} battery_load_t;
+
+typedef struct
+{
+    float voltage;         // measured terminal voltage
+    float ocv;             // open-circuit voltage after load compensation
+    float load_ma;         // modelled current draw
+    float percent;         // smoothed state of charge 0..100
+    float hours_remaining; // at the current load
+} battery_soc_t;
+
+void battery_soc_init(void);
+void battery_soc_current_load(battery_load_t *load);
+float battery_soc_load_ma(const battery_load_t *load);
+float battery_soc_ocv_to_percent(float ocv);
+float battery_soc_hours_at(float percent, float load_ma);
+void battery_soc_update(float voltage);
+void battery_soc_get(battery_soc_t *soc);
@@ -0,0 +1,164 @@
+#include "esp_log.h"
+#include "display/wavesharelcd2/display_init.h"
+#include "scale/ble.h"
+#include "scale/ble_relay.h"
+#include "ui/view01.h"
+#include "power_profile.h"
+
+// A profile is left again only when the SoC climbs this far above its threshold,
+// so the measurement noise around a threshold does not toggle the backlight
+#define PROFILE_HYSTERESIS_PCT 3
+
+static const char *TAG = "power_profile";
+
+static power_profile_t profiles[POWER_PROFILE_COUNT] = {
+    [POWER_PROFILE_FULL] = {
+        .name = "",
+        .threshold_pct = 100,
+        .backlight_level = 80,
+        .refr_period_ms = 33,
+        .conn_interval_ms = 0, // whatever the scale negotiated
+        .background_tasks = true,
+    },
+    [POWER_PROFILE_ECO] = {
+        .name = "ECO",
+        .threshold_pct = 40,
+        .backlight_level = 50,
+        .refr_period_ms = 50,
+        .conn_interval_ms = 50,
+        .background_tasks = true,
+    },
+    [POWER_PROFILE_SAVER] = {
+        .name = "SAVE",
+        .threshold_pct = 15,
+        .backlight_level = 30,
+        .refr_period_ms = 100,
+        .conn_interval_ms = 100,
+        .background_tasks = false,
+    },
+    [POWER_PROFILE_CRITICAL] = {
+        .name = "LOW",
+        .threshold_pct = 5,
+        .backlight_level = 15,
+        .refr_period_ms = 200,
+        .conn_interval_ms = 200,
+        .background_tasks = false,
+    },
+};
+
+static power_profile_id_t active = POWER_PROFILE_FULL;
+
+static power_profile_id_t select_profile(float soc_percent)
+{
+    power_profile_id_t id = POWER_PROFILE_FULL;
+    for (int i = POWER_PROFILE_ECO; i < POWER_PROFILE_COUNT; i++)
+    {
+        // stay in a lower profile until the SoC clearly recovered (e.g. while charging)
+        float threshold = profiles[i].threshold_pct + (i <= active ? PROFILE_HYSTERESIS_PCT : 0);
+        if (soc_percent < threshold)
+        {
+            id = i;
+        }
+    }
+    return id;
+}
+
+static void apply_profile(power_profile_id_t id)
+{
+    const power_profile_t *p = &profiles[id];
+    ESP_LOGI(TAG, "Power profile %s: backlight %d%%, refresh %lu ms, conn interval %d ms",
+             id == POWER_PROFILE_FULL ? "FULL" : p->name, p->backlight_level, p->refr_period_ms, p->conn_interval_ms);
+    bsp_brightness_set_level(p->backlight_level);
+    lvgl_set_refresh_period(p->refr_period_ms);
+    set_power_profile(p->name);
+    ble_relay_set_advertising(p->background_tasks);
+}
+
+// A reconnect falls back to the interval the scale asks for, so this is checked on every update
+static void apply_conn_interval(const power_profile_t *p)
+{
+    if (!scale_is_connected())
+    {
+        return;
+    }
+    if (p->conn_interval_ms == 0)
+    {
+        scale_restore_conn_interval();
+    }
+    else if (scale_get_conn_interval_ms() != p->conn_interval_ms)
+    {
+        scale_set_conn_interval(p->conn_interval_ms);
+    }
+}
+
+void power_profile_update(float soc_percent)
+{
+    power_profile_id_t id = select_profile(soc_percent);
+    if (id != active)
+    {
+        active = id;
+        apply_profile(id);
+    }
+    apply_conn_interval(&profiles[active]);
+}
+
+power_profile_id_t power_profile_active(void)
+{
+    return active;
+}
+
+const power_profile_t *power_profile_get(power_profile_id_t id)
+{
+    return &profiles[id];
+}
+
+void power_profile_set_threshold(power_profile_id_t id, uint8_t threshold_pct)
+{
+    if (id == POWER_PROFILE_FULL || id >= POWER_PROFILE_COUNT)
+    {
+        return;
+    }
+    profiles[id].threshold_pct = threshold_pct;
+}
+
+// Live tuning from the console, POWER_PROFILE_KEEP keeps the current value. A connection interval
+// of 0 hands the choice back to the scale.
+void power_profile_set_full(int backlight_level, int32_t refr_period_ms, int32_t conn_interval_ms)
+{
+    power_profile_t *p = &profiles[POWER_PROFILE_FULL];
+    if (backlight_level != POWER_PROFILE_KEEP)
+    {
+        p->backlight_level = backlight_level;
+    }
+    if (refr_period_ms != POWER_PROFILE_KEEP)
+    {
+        p->refr_period_ms = refr_period_ms;
+    }
+    if (conn_interval_ms != POWER_PROFILE_KEEP)
+    {
+        p->conn_interval_ms = conn_interval_ms;
+    }
+    if (active == POWER_PROFILE_FULL)
+    {
+        apply_profile(POWER_PROFILE_FULL);
+        apply_conn_interval(p);
+    }
+}
+
+bool power_profile_background_allowed(void)
+{
+    return profiles[active].background_tasks;
+}
+
+/**
+ * Hours the battery would last from the given SoC if the profile were active now.
+ * Compare against POWER_PROFILE_FULL to get the runtime gain of a profile.
+ */
+float power_profile_projected_hours(power_profile_id_t id, const battery_soc_t *soc)
+{
+    battery_load_t load;
+    battery_soc_current_load(&load);
+    load.backlight_level = profiles[id].backlight_level;
+    load.ble_conn_interval_ms = profiles[id].conn_interval_ms;
+    return battery_soc_hours_at(soc->percent, battery_soc_load_ma(&load));
+}
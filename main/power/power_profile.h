@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "battery_soc.h"
+
+typedef enum
+{
+    POWER_PROFILE_FULL,
+    POWER_PROFILE_ECO,
+    POWER_PROFILE_SAVER,
+    POWER_PROFILE_CRITICAL,
+    POWER_PROFILE_COUNT,
+} power_profile_id_t;
+
+typedef struct
+{
+    const char *name;
+    uint8_t threshold_pct;     // profile is entered when the SoC drops below this value
+    uint8_t backlight_level;   // 0..100
+    uint32_t refr_period_ms;   // LVGL display refresh period
+    uint16_t conn_interval_ms; // requested BLE connection interval, 0 = leave to the scale
+    bool background_tasks;     // relay advertising and the periodic diagnostics log may run
+} power_profile_t;
+
+#define POWER_PROFILE_KEEP (-1) // power_profile_set_full leaves the value as it is
+
+void power_profile_update(float soc_percent);
+power_profile_id_t power_profile_active(void);
+const power_profile_t *power_profile_get(power_profile_id_t id);
+void power_profile_set_threshold(power_profile_id_t id, uint8_t threshold_pct);
+void power_profile_set_full(int backlight_level, int32_t refr_period_ms, int32_t conn_interval_ms);
+bool power_profile_background_allowed(void);
+float power_profile_projected_hours(power_profile_id_t id, const battery_soc_t *soc);
@@ -16,92 +16,319 @@
 #include "esp_bt_main.h"
 #include "esp_gatt_common_api.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "ble.h"
+#include "ble_relay.h"
+#include "scale_driver.h"
+#include "handle_cache.h"
+#include "diag/latency_trace.h"
+#include "diag/dlog.h"
+#include "shot/shot_log.h"
+#include "stream/usb_stream.h"
 
-#define SCALE_SERVICE_UUID 0xFFF0
-#define SET_CHAR_UUID 0x36F5
-#define NOTIFY_CHAR_UUID 0xFFF4
 #define PROFILE_NUM 1
 #define PROFILE_A_APP_ID 0
 #define INVALID_HANDLE 0
+#define SCALE_SAMPLE_RING 16 // power of two
+#define SCALE_CMD_QUEUE 8
+#define SCALE_RESCAN_SECONDS 30
+#define SCALE_HEARTBEAT_TICK_MS 1000
+#define SCALE_KNOWN_SCAN_SECONDS 10 // passive scan for known addresses before looking for new scales
+#define SCALE_SCAN_INTERVAL 0xA0    // 100 ms, unit is 0.625 ms
+#define SCALE_SCAN_WINDOW 0x20      // 20 ms, the radio listens 20% of the time
+// 1 = log every advertisement seen while scanning, costs a lot of time on the BT task in a busy place
+#define SCALE_SCAN_DEBUG 0
+#define SCALE_BACKOFF_MIN_MS 1000
+#define SCALE_BACKOFF_MAX_MS 60000
+#define SCALE_STALE_MARGIN_MS 50 // on top of one sample period, for notifications that wait for the next connection event
+#define SCALE_DLE_OCTETS 251    // largest link layer payload, a whole notification fits one PDU
+#define SCALE_DEFAULT_OCTETS 27 // link layer payload without data length extension
+#define SCALE_SUPERVISION_MIN_MS 4000
+#define SCALE_SUPERVISION_INTERVALS 6 // intervals missed in a row before the link is dropped
 #if CONFIG_EXAMPLE_INIT_DEINIT_LOOP
 #define EXAMPLE_TEST_COUNT 50
 #endif
 
-static char remote_device_name[ESP_BLE_ADV_NAME_LEN_MAX] = "Decent Scale";
-static bool connect = false;
-static bool get_server = false;
-static esp_gattc_char_elem_t *char_elem_result = NULL;
-static esp_gattc_descr_elem_t *descr_elem_result = NULL;
+static bool scanning_wanted = false;
+static bool scanning = false;
+static bool scan_starting = false; // scan params requested, the scan start event is still to come
+static bool scan_known = false; // whitelist scan for the addresses of known scales
+static bool scan_matched = false;
+static uint32_t scan_duration_s = 0;
+static int64_t scan_start_us = 0;
 
-static uint8_t tare[] = {0x03, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x0c};
-static uint8_t led_on_gram[] = {0x03, 0x0a, 0x01, 0x01, 0x00, 0x00, 0x09};
-static uint8_t led_on_ounce[] = {0x03, 0x0a, 0x01, 0x01, 0x01, 0x00, 0x08};
-static uint8_t led_off[] = {0x03, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x09};
-
-static uint8_t power_off[] = {0x03, 0x0a, 0x02, 0x00, 0x00, 0x00, 0x0b};
-
-static uint8_t timer_on[] = {0x03, 0x0b, 0x03, 0x00, 0x00, 0x00, 0x0b};
-static uint8_t timer_off[] = {0x03, 0x0b, 0x00, 0x00, 0x00, 0x00, 0x08};
-static uint8_t timer_reset[] = {0x03, 0x0b, 0x02, 0x00, 0x00, 0x00, 0x0a};
+static esp_timer_handle_t heartbeat_timer = NULL;
 
 /* Declare static functions */
 static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
 static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
 static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
-void write_char(uint8_t write_data[]);
 
 char *TAG = "ble";
 
-// The UUID of the service containing characteristics: 0000fff0-0000-1000-8000-00805f9b34fb
-// The UUID of the set chatacteristic:                 000036f5-0000-1000-8000-00805f9b34fb
-// The UUID of the notify chatacteristic:              0000FFF3-0000-1000-8000-00805f9b34fb
+// State of one scale connection. Slots stay bound to the address of the scale, so a scale
+// keeps its role (cup or dose) across reconnects.
+typedef struct
+{
+    bool in_use; // remote_bda is bound to this slot
+    bool connect;
+    bool get_server;
+    bool notify_registering;
+    bool cache_valid; // handles below are known from an earlier connection to remote_bda
+    scale_state_t state;
+    uint32_t backoff_ms;
+    esp_timer_handle_t reconnect_timer;
+    uint16_t conn_id;
+    uint16_t conn_interval_ms;
+    uint16_t peer_interval_ms; // interval the link settled on without us asking, restored by the FULL profile
+    bool interval_requested; // the next parameter update is the answer to scale_set_conn_interval
+    bool dle_pending; // the data length event carries no address, see SET_PKT_LENGTH_COMPLETE
+    bool airtime_logged;
+    uint16_t rx_octets; // longest PDU payload the scale may send
+    uint16_t service_start_handle;
+    uint16_t service_end_handle;
+    uint16_t set_char_handle;
+    uint16_t notify_char_handle;
+    uint16_t ccc_handle;
+    esp_bd_addr_t remote_bda;
+    esp_ble_addr_type_t remote_addr_type;
+    const scale_driver_t *driver; // protocol of the scale, chosen from its advertised name
+    int64_t last_command_us;
 
-static int16_t weight10 = 0;
-static SemaphoreHandle_t weight_mutex = NULL;
+    // weights in 0.1 g, only written by the Bluetooth task
+    int16_t samples[SCALE_SAMPLE_RING];
+    volatile uint32_t sample_head;
+    volatile int64_t last_sample_us;
 
-static void set_weight10(int16_t value)
+    // commands waiting for the write before them to complete, guarded by cmd_mux
+    struct
+    {
+        uint8_t len;
+        uint8_t data[SCALE_CMD_MAX];
+    } cmds[SCALE_CMD_QUEUE];
+    uint8_t cmd_head;
+    uint8_t cmd_count;
+    bool cmd_in_flight;
+} scale_conn_t;
+
+static scale_conn_t conns[SCALE_MAX];
+static scale_weight_listener_t weight_listener = NULL;
+static portMUX_TYPE cmd_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// conns[], the scan state and the whitelist are changed by the GAP and GATT handlers on the BT task,
+// by the reconnect timers and by switching on. The handlers run one at a time with this lock held.
+static StaticSemaphore_t link_lock_buf;
+static SemaphoreHandle_t link_lock = NULL;
+
+static scale_conn_t *find_conn_by_id(uint16_t conn_id)
 {
-    if (weight_mutex == NULL)
+    for (int i = 0; i < SCALE_MAX; i++)
     {
-        weight_mutex = xSemaphoreCreateMutex();
+        if (conns[i].connect && conns[i].conn_id == conn_id)
+        {
+            return &conns[i];
+        }
     }
-    if (xSemaphoreTake(weight_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+    return NULL;
+}
+
+static scale_conn_t *find_conn_by_bda(const esp_bd_addr_t bda)
+{
+    for (int i = 0; i < SCALE_MAX; i++)
     {
-        weight10 = value;
-        xSemaphoreGive(weight_mutex);
+        if (conns[i].in_use && memcmp(conns[i].remote_bda, bda, sizeof(esp_bd_addr_t)) == 0)
+        {
+            return &conns[i];
+        }
     }
+    return NULL;
 }
 
-int16_t get_weight10()
+// The slot this scale had before, else the first one that was never used, else one that is not connected
+static scale_conn_t *bind_conn(const esp_bd_addr_t bda)
 {
-    int16_t retval = 0;
-    if (weight_mutex == NULL)
+    scale_conn_t *c = find_conn_by_bda(bda);
+    for (int i = 0; c == NULL && i < SCALE_MAX; i++)
     {
-        weight_mutex = xSemaphoreCreateMutex();
+        if (!conns[i].in_use)
+        {
+            c = &conns[i];
+        }
     }
-    if (xSemaphoreTake(weight_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+    for (int i = 0; c == NULL && i < SCALE_MAX; i++)
     {
-        retval = weight10;
-        xSemaphoreGive(weight_mutex);
+        if (!conns[i].connect)
+        {
+            c = &conns[i];
+        }
     }
-    return retval;
+    if (c != NULL && !c->in_use)
+    {
+        c->in_use = true;
+        memcpy(c->remote_bda, bda, sizeof(esp_bd_addr_t));
+    }
+    else if (c != NULL && memcmp(c->remote_bda, bda, sizeof(esp_bd_addr_t)) != 0)
+    {
+        memcpy(c->remote_bda, bda, sizeof(esp_bd_addr_t));
+        c->sample_head = 0;
+        c->cache_valid = false;
+    }
+    return c;
 }
 
-static esp_bt_uuid_t set_char_uuid = {
-    .len = ESP_UUID_LEN_16,
-    .uuid = {
-        .uuid16 = SET_CHAR_UUID,
-    },
-};
+static bool slot_available(void)
+{
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        if (!conns[i].connect)
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
-static esp_bt_uuid_t notify_char_uuid = {
-    .len = ESP_UUID_LEN_16,
-    .uuid = {
-        .uuid16 = NOTIFY_CHAR_UUID,
-    },
-};
+static void push_sample(scale_conn_t *c, int16_t value)
+{
+    c->samples[c->sample_head & (SCALE_SAMPLE_RING - 1)] = value;
+    c->sample_head++;
+    c->last_sample_us = esp_timer_get_time();
+}
+
+static const char *const state_names[] = {"idle", "scanning", "connecting", "discovering", "streaming", "backoff"};
+
+static void set_state(scale_conn_t *c, scale_state_t state)
+{
+    if (c->state != state)
+    {
+        DLOGI(TAG, "Scale %d %s -> %s", (int)(c - conns), state_names[c->state], state_names[state]);
+        c->state = state;
+    }
+}
+
+// Retry later, every failed attempt doubles the wait up to SCALE_BACKOFF_MAX_MS
+static void enter_backoff(scale_conn_t *c)
+{
+    if (c->backoff_ms == 0)
+    {
+        c->backoff_ms = SCALE_BACKOFF_MIN_MS;
+    }
+    set_state(c, SCALE_STATE_BACKOFF);
+    DLOGI(TAG, "Scale %d reconnect in %lu ms", (int)(c - conns), c->backoff_ms);
+    esp_timer_stop(c->reconnect_timer);
+    esp_timer_start_once(c->reconnect_timer, c->backoff_ms * 1000ULL);
+    c->backoff_ms *= 2;
+    if (c->backoff_ms > SCALE_BACKOFF_MAX_MS)
+    {
+        c->backoff_ms = SCALE_BACKOFF_MAX_MS;
+    }
+}
+
+// Time on air of one notification from the scale on the 1M PHY (8 us per byte). The value gets the
+// ATT opcode and handle and the L2CAP header, is split into PDUs of at most rx_octets, and every PDU
+// adds preamble, access address, header and CRC. PDUs of one notification are 150 us apart.
+static uint32_t notify_airtime_us(const scale_conn_t *c, uint16_t value_len)
+{
+    uint16_t payload = value_len + 3 + 4;
+    uint16_t pdus = (payload + c->rx_octets - 1) / c->rx_octets;
+    uint16_t overhead = 1 + 4 + 2 + 3;
+    return (payload + pdus * overhead) * 8 + (pdus - 1) * 150;
+}
+
+int16_t scale_get_weight10(scale_id_t id)
+{
+    scale_conn_t *c = &conns[id];
+    if (c->sample_head == 0)
+    {
+        return 0;
+    }
+    return c->samples[(c->sample_head - 1) & (SCALE_SAMPLE_RING - 1)];
+}
+
+int16_t get_weight10()
+{
+    return scale_get_weight10(SCALE_CUP);
+}
+
+void scale_set_weight_listener(scale_weight_listener_t listener)
+{
+    weight_listener = listener;
+}
+
+bool scale_id_connected(scale_id_t id)
+{
+    return conns[id].connect;
+}
+
+bool scale_is_connected()
+{
+    return conns[SCALE_CUP].connect || conns[SCALE_DOSE].connect;
+}
+
+scale_state_t scale_get_state(scale_id_t id)
+{
+    return conns[id].state;
+}
+
+// When the weight turns stale unless another sample arrives: one sample period after the last one,
+// plus a margin. 0 if it is stale already because the scale does not stream.
+int64_t scale_stale_at_us(scale_id_t id)
+{
+    scale_conn_t *c = &conns[id];
+    if (c->state != SCALE_STATE_STREAMING || c->driver == NULL)
+    {
+        return 0;
+    }
+    return c->last_sample_us + (c->driver->sample_ms + SCALE_STALE_MARGIN_MS) * 1000LL;
+}
+
+// A dropped link is only reported after the supervision timeout, a missing notification
+// as soon as the next one was due.
+bool scale_weight_stale(scale_id_t id)
+{
+    int64_t stale_at = scale_stale_at_us(id);
+    return stale_at == 0 || esp_timer_get_time() >= stale_at;
+}
+
+// For the console: one line per scale slot, the sample rate is measured since the previous call
+void scale_log_links(void)
+{
+    static uint32_t prev_head[SCALE_MAX];
+    static int64_t prev_us[SCALE_MAX];
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        scale_conn_t *c = &conns[i];
+        uint32_t head = c->sample_head;
+        float rate = prev_us[i] != 0 ? (head - prev_head[i]) * 1e6f / (now - prev_us[i]) : 0.0f;
+        prev_head[i] = head;
+        prev_us[i] = now;
+        if (!c->in_use)
+        {
+            ESP_LOGI(TAG, "Scale %d unbound", i);
+            continue;
+        }
+        ESP_LOGI(TAG, "Scale %d " ESP_BD_ADDR_STR " %s, %s, interval %u ms, %u byte PDUs, %.1f samples/s, weight %d",
+                 i, ESP_BD_ADDR_HEX(c->remote_bda), c->driver != NULL ? c->driver->name : "?", state_names[c->state],
+                 c->conn_interval_ms, c->rx_octets, rate, scale_get_weight10(i));
+    }
+}
+
+// Shortest interval of all links, that is the one that costs the most power
+uint16_t scale_get_conn_interval_ms()
+{
+    uint16_t interval = 0;
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        if (conns[i].conn_interval_ms != 0 && (interval == 0 || conns[i].conn_interval_ms < interval))
+        {
+            interval = conns[i].conn_interval_ms;
+        }
+    }
+    return interval;
+}
 
 static esp_bt_uuid_t notify_descr_uuid = {
     .len = ESP_UUID_LEN_16,
@@ -110,25 +337,30 @@ static esp_bt_uuid_t notify_descr_uuid = {
     },
 };
 
+// New scales may only put their name into the scan response, so discovery has to scan actively.
+// Duplicate filtering stays off, the controller would drop the scan response of an address it already reported.
 static esp_ble_scan_params_t ble_scan_params = {
     .scan_type = BLE_SCAN_TYPE_ACTIVE,
     .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
     .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
-    .scan_interval = 0x50,
-    .scan_window = 0x30,
+    .scan_interval = SCALE_SCAN_INTERVAL,
+    .scan_window = SCALE_SCAN_WINDOW,
     .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE};
 
+// Known scales are found by address, the controller filters and nothing is sent
+static esp_ble_scan_params_t known_scan_params = {
+    .scan_type = BLE_SCAN_TYPE_PASSIVE,
+    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+    .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ONLY_WLST,
+    .scan_interval = SCALE_SCAN_INTERVAL,
+    .scan_window = SCALE_SCAN_WINDOW,
+    .scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE};
+
 struct gattc_profile_inst
 {
     esp_gattc_cb_t gattc_cb;
     uint16_t gattc_if;
     uint16_t app_id;
-    uint16_t conn_id;
-    uint16_t service_start_handle;
-    uint16_t service_end_handle;
-    uint16_t set_char_handle;
-    uint16_t notify_char_handle;
-    esp_bd_addr_t remote_bda;
 };
 
 /* One gatt-based profile one app_id and one gattc_if, this array will store the gattc_if returned by ESP_GATTS_REG_EVT */
@@ -139,16 +371,270 @@ static struct gattc_profile_inst gl_profile_tab[PROFILE_NUM] = {
     },
 };
 
-// Decent Scale requires to be sent a few commands before it
-// starts delivering weight notifications
-void init_scale()
+static void send_next_command(scale_conn_t *c);
+static void init_scale(scale_conn_t *c);
+
+// Scans for a known scale first if there is one, the scan params event starts the scan.
+// duration_s 0 scans until something is found.
+static void start_scan(uint32_t duration_s)
+{
+    if (scanning || scan_starting)
+    {
+        return;
+    }
+    scan_duration_s = duration_s;
+    scan_known = false;
+    esp_ble_gap_clear_whitelist();
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        if (!conns[i].connect)
+        {
+            esp_timer_stop(conns[i].reconnect_timer);
+            set_state(&conns[i], SCALE_STATE_SCANNING);
+        }
+        if (conns[i].in_use && !conns[i].connect)
+        {
+            esp_ble_wl_addr_type_t type = conns[i].remote_addr_type == BLE_ADDR_TYPE_PUBLIC ? BLE_WL_ADDR_TYPE_PUBLIC : BLE_WL_ADDR_TYPE_RANDOM;
+            if (esp_ble_gap_update_whitelist(true, conns[i].remote_bda, type) == ESP_OK)
+            {
+                scan_known = true;
+            }
+        }
+    }
+    esp_err_t ret = esp_ble_gap_set_scan_params(scan_known ? &known_scan_params : &ble_scan_params);
+    if (ret)
+    {
+        ESP_LOGE(TAG, "set scan params error, error code = %x", ret);
+        return;
+    }
+    scan_starting = true;
+}
+
+static void store_handles(scale_conn_t *c)
+{
+    scale_handles_t handles = {
+        .service_start = c->service_start_handle,
+        .service_end = c->service_end_handle,
+        .set_char = c->set_char_handle,
+        .notify_char = c->notify_char_handle,
+        .ccc = c->ccc_handle,
+    };
+    handle_cache_store(c->remote_bda, c->driver->name, &handles);
+}
+
+static void load_handles(scale_conn_t *c)
+{
+    scale_handles_t handles;
+    if (handle_cache_load(c->remote_bda, c->driver->name, &handles))
+    {
+        c->service_start_handle = handles.service_start;
+        c->service_end_handle = handles.service_end;
+        c->set_char_handle = handles.set_char;
+        c->notify_char_handle = handles.notify_char;
+        c->ccc_handle = handles.ccc;
+        c->cache_valid = true;
+    }
+}
+
+// Handles are only checked when the scale says they changed or an access to them fails
+static void invalidate_handles(scale_conn_t *c)
+{
+    if (c->cache_valid)
+    {
+        c->cache_valid = false;
+        handle_cache_erase(c->remote_bda);
+    }
+}
+
+// Our handles and the attribute table Bluedroid keeps in NVS turned out to be wrong. Both are
+// dropped and the link is closed, the next connection discovers over the air.
+static void drop_cached_link(esp_gatt_if_t gattc_if, scale_conn_t *c)
+{
+    invalidate_handles(c);
+    esp_ble_gattc_cache_clean(c->remote_bda);
+    esp_ble_gattc_close(gattc_if, c->conn_id);
+}
+
+// Runs on the esp_timer task, the link lock keeps it apart from the BT task handlers
+static void reconnect_cb(void *arg)
+{
+    scale_conn_t *c = (scale_conn_t *)arg;
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    if (scanning_wanted && c->state == SCALE_STATE_BACKOFF)
+    {
+        // a scan that is already running picks the scale up by its address
+        set_state(c, SCALE_STATE_SCANNING);
+        start_scan(SCALE_RESCAN_SECONDS);
+    }
+    xSemaphoreGive(link_lock);
+}
+
+// Handles from the last connection, skip the service search and go straight to notifications
+static void resume_streaming(esp_gatt_if_t gattc_if, scale_conn_t *c)
+{
+    DLOGI(TAG, "Scale %d handles cached, skipping service search", (int)(c - conns));
+    c->get_server = true;
+    c->notify_registering = true;
+    esp_ble_gattc_register_for_notify(gattc_if, c->remote_bda, c->notify_char_handle);
+    init_scale(c);
+}
+
+static void enable_notify(esp_gatt_if_t gattc_if, scale_conn_t *c)
+{
+    uint16_t notify_en = 1;
+    esp_gatt_status_t ret_status = esp_ble_gattc_write_char_descr(gattc_if,
+                                                                  c->conn_id,
+                                                                  c->ccc_handle,
+                                                                  sizeof(notify_en),
+                                                                  (uint8_t *)&notify_en,
+                                                                  ESP_GATT_WRITE_TYPE_RSP,
+                                                                  ESP_GATT_AUTH_REQ_NONE);
+    if (ret_status != ESP_GATT_OK)
+    {
+        ESP_LOGE(TAG, "esp_ble_gattc_write_char_descr error");
+    }
+}
+
+uint8_t scale_get_scan_duty_pct(void)
+{
+    return scanning ? SCALE_SCAN_WINDOW * 100 / SCALE_SCAN_INTERVAL : 0;
+}
+
+static void write_char(scale_conn_t *c, const uint8_t *write_data, uint8_t len)
+{
+    c->last_command_us = esp_timer_get_time();
+    esp_err_t ret = esp_ble_gattc_write_char(
+        gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
+        c->conn_id,
+        c->set_char_handle,
+        len,
+        (uint8_t *)write_data,
+        c->driver->write_type,
+        ESP_GATT_AUTH_REQ_NONE);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Write to set charact with handle %d failed", c->set_char_handle);
+        // no write event will follow, carry on with the next command
+        send_next_command(c);
+    }
+}
+
+// Only one write with response can be outstanding per link, the rest waits for ESP_GATTC_WRITE_CHAR_EVT
+static void send_next_command(scale_conn_t *c)
+{
+    uint8_t cmd[SCALE_CMD_MAX];
+    uint8_t len = 0;
+    bool have_cmd = false;
+
+    taskENTER_CRITICAL(&cmd_mux);
+    if (c->cmd_count > 0)
+    {
+        len = c->cmds[c->cmd_head].len;
+        memcpy(cmd, c->cmds[c->cmd_head].data, len);
+        c->cmd_head = (c->cmd_head + 1) % SCALE_CMD_QUEUE;
+        c->cmd_count--;
+        have_cmd = true;
+    }
+    else
+    {
+        c->cmd_in_flight = false;
+    }
+    taskEXIT_CRITICAL(&cmd_mux);
+
+    if (have_cmd)
+    {
+        write_char(c, cmd, len);
+    }
+}
+
+static void queue_command(scale_conn_t *c, scale_cmd_t id)
+{
+    uint8_t cmd[SCALE_CMD_MAX];
+    bool send_now = false;
+    bool dropped = false;
+
+    if (c->driver == NULL)
+    {
+        return;
+    }
+    uint8_t len = c->driver->encode(id, cmd);
+    if (len == 0)
+    {
+        // the scale has no such command
+        return;
+    }
+
+    taskENTER_CRITICAL(&cmd_mux);
+    if (!c->connect || c->set_char_handle == INVALID_HANDLE ||
+        (c->state != SCALE_STATE_DISCOVERING && c->state != SCALE_STATE_STREAMING))
+    {
+        dropped = true;
+    }
+    else if (!c->cmd_in_flight)
+    {
+        c->cmd_in_flight = true;
+        send_now = true;
+    }
+    else if (c->cmd_count < SCALE_CMD_QUEUE)
+    {
+        int tail = (c->cmd_head + c->cmd_count) % SCALE_CMD_QUEUE;
+        c->cmds[tail].len = len;
+        memcpy(c->cmds[tail].data, cmd, len);
+        c->cmd_count++;
+    }
+    else
+    {
+        dropped = true;
+    }
+    taskEXIT_CRITICAL(&cmd_mux);
+
+    if (send_now)
+    {
+        write_char(c, cmd, len);
+    }
+    else if (dropped)
+    {
+        ESP_LOGW(TAG, "Command %d dropped", id);
+    }
+}
+
+void scale_send_command(scale_id_t id, scale_cmd_t cmd)
 {
-    vTaskDelay(pdMS_TO_TICKS(100));
-    scale_tare();
-    vTaskDelay(pdMS_TO_TICKS(100));
-    scale_led_on_gram();
-    vTaskDelay(pdMS_TO_TICKS(100));
-    scale_tare();
+    queue_command(&conns[id], cmd);
+}
+
+static void reset_commands(scale_conn_t *c)
+{
+    taskENTER_CRITICAL(&cmd_mux);
+    c->cmd_head = 0;
+    c->cmd_count = 0;
+    c->cmd_in_flight = false;
+    taskEXIT_CRITICAL(&cmd_mux);
+}
+
+// Most scales need a few commands before they start delivering weight notifications.
+// The command queue spaces them out, the Bluetooth task must not sleep here or it stalls the other link.
+static void init_scale(scale_conn_t *c)
+{
+    for (int i = 0; i < c->driver->init_cmd_count; i++)
+    {
+        queue_command(c, c->driver->init_cmds[i]);
+    }
+}
+
+// Scales that drop the link when idle get a keep alive unless a command went out recently
+static void heartbeat_cb(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        scale_conn_t *c = &conns[i];
+        if (c->connect && c->driver != NULL && c->driver->heartbeat_ms != 0 &&
+            now - c->last_command_us >= c->driver->heartbeat_ms * 1000LL)
+        {
+            queue_command(c, SCALE_CMD_HEARTBEAT);
+        }
+    }
 }
 
 void uuid128_to_string(const uint8_t *uuid128, char *str_buf, size_t buf_size)
@@ -168,38 +654,82 @@ void uuid128_to_string(const uint8_t *uuid128, char *str_buf, size_t buf_size)
 static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
 {
     esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
+    scale_conn_t *c = NULL;
 
     switch (event)
     {
     case ESP_GATTC_REG_EVT:
-        ESP_LOGI(TAG, "GATT client register, status %d, app_id %d, gattc_if %d", param->reg.status, param->reg.app_id, gattc_if);
-        esp_err_t scan_ret = esp_ble_gap_set_scan_params(&ble_scan_params);
-        if (scan_ret)
-        {
-            ESP_LOGE(TAG, "set scan params error, error code = %x", scan_ret);
-        }
+        DLOGI(TAG, "GATT client register, status %d, app_id %d, gattc_if %d", param->reg.status, param->reg.app_id, gattc_if);
+        start_scan(0);
         break;
     case ESP_GATTC_CONNECT_EVT:
     {
-        ESP_LOGI(TAG, "Connected, conn_id %d, remote " ESP_BD_ADDR_STR "", p_data->connect.conn_id,
+        // phones connecting to the relay show up here as well, the scale is the link where we are central
+        if (p_data->connect.link_role != 0)
+        {
+            break;
+        }
+        c = bind_conn(p_data->connect.remote_bda);
+        if (c == NULL || c->driver == NULL)
+        {
+            ESP_LOGW(TAG, "No free scale slot for " ESP_BD_ADDR_STR "", ESP_BD_ADDR_HEX(p_data->connect.remote_bda));
+            esp_ble_gattc_close(gattc_if, p_data->connect.conn_id);
+            break;
+        }
+        ESP_LOGI(TAG, "Connected scale %d, conn_id %d, remote " ESP_BD_ADDR_STR "", (int)(c - conns), p_data->connect.conn_id,
                  ESP_BD_ADDR_HEX(p_data->connect.remote_bda));
-        gl_profile_tab[PROFILE_A_APP_ID].conn_id = p_data->connect.conn_id;
-        memcpy(gl_profile_tab[PROFILE_A_APP_ID].remote_bda, p_data->connect.remote_bda, sizeof(esp_bd_addr_t));
+        c->connect = true;
+        set_state(c, SCALE_STATE_DISCOVERING);
+        c->conn_id = p_data->connect.conn_id;
+        c->conn_interval_ms = p_data->connect.conn_params.interval * 5 / 4; // unit is 1.25 ms
+        c->peer_interval_ms = c->conn_interval_ms;
+        c->interval_requested = false;
         esp_err_t mtu_ret = esp_ble_gattc_send_mtu_req(gattc_if, p_data->connect.conn_id);
         if (mtu_ret)
         {
             ESP_LOGE(TAG, "Config MTU error, error code = %x", mtu_ret);
         }
 
+        // Larger PDUs shorten the radio on-time per notification, scales without data length
+        // extension stay at 27 bytes. The link stays on the 1M PHY: requesting 2M needs the
+        // BLE 5.0 feature set of Bluedroid, and this build uses the 4.2 legacy scan and advertising.
+        c->rx_octets = SCALE_DEFAULT_OCTETS;
+        c->airtime_logged = false;
+        c->dle_pending = esp_ble_gap_set_pkt_data_len(p_data->connect.remote_bda, SCALE_DLE_OCTETS) == ESP_OK;
         break;
     }
     case ESP_GATTC_OPEN_EVT:
         if (param->open.status != ESP_GATT_OK)
         {
             ESP_LOGE(TAG, "Open failed, status %d", p_data->open.status);
-            break;
+            c = find_conn_by_bda(p_data->open.remote_bda);
+            if (c != NULL)
+            {
+                c->connect = false;
+                if (scanning_wanted)
+                {
+                    enter_backoff(c);
+                }
+                else
+                {
+                    set_state(c, SCALE_STATE_IDLE);
+                }
+            }
+        }
+        else
+        {
+            DLOGI(TAG, "Open successfully, MTU %u", p_data->open.mtu);
+            c = find_conn_by_bda(p_data->open.remote_bda);
+            if (c != NULL && c->connect && c->cache_valid)
+            {
+                resume_streaming(gattc_if, c);
+            }
+        }
+        // look for the second scale while there is a free slot
+        if (scanning_wanted && slot_available())
+        {
+            start_scan(SCALE_RESCAN_SECONDS);
         }
-        ESP_LOGI(TAG, "Open successfully, MTU %u", p_data->open.mtu);
         break;
     case ESP_GATTC_DIS_SRVC_CMPL_EVT:
         if (param->dis_srvc_cmpl.status != ESP_GATT_OK)
@@ -207,26 +737,36 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
             ESP_LOGE(TAG, "Service discover failed, status %d", param->dis_srvc_cmpl.status);
             break;
         }
-        ESP_LOGI(TAG, "Service discover complete, conn_id %d", param->dis_srvc_cmpl.conn_id);
+        DLOGI(TAG, "Service discover complete, conn_id %d", param->dis_srvc_cmpl.conn_id);
+        c = find_conn_by_id(param->dis_srvc_cmpl.conn_id);
+        if (c != NULL && c->cache_valid)
+        {
+            break;
+        }
         esp_ble_gattc_search_service(gattc_if, param->dis_srvc_cmpl.conn_id, NULL);
         break;
     case ESP_GATTC_CFG_MTU_EVT:
-        ESP_LOGI(TAG, "MTU exchange, status %d, MTU %d", param->cfg_mtu.status, param->cfg_mtu.mtu);
+        DLOGI(TAG, "MTU exchange, status %d, MTU %d", param->cfg_mtu.status, param->cfg_mtu.mtu);
         break;
     case ESP_GATTC_SEARCH_RES_EVT:
     {
-        ESP_LOGI(TAG, "Service search result, conn_id = %x, is primary service %d", p_data->search_res.conn_id, p_data->search_res.is_primary);
-        ESP_LOGI(TAG, "start handle %d, end handle %d, current handle value %d", p_data->search_res.start_handle, p_data->search_res.end_handle, p_data->search_res.srvc_id.inst_id);
+        c = find_conn_by_id(p_data->search_res.conn_id);
+        if (c == NULL)
+        {
+            break;
+        }
+        DLOGI(TAG, "Service search result, conn_id = %x, is primary service %d", p_data->search_res.conn_id, p_data->search_res.is_primary);
+        DLOGI(TAG, "start handle %d, end handle %d, current handle value %d", p_data->search_res.start_handle, p_data->search_res.end_handle, p_data->search_res.srvc_id.inst_id);
         esp_bt_uuid_t *uuid = &p_data->search_res.srvc_id.uuid;
 
         if (uuid->len == ESP_UUID_LEN_16)
         {
-            ESP_LOGI(TAG, "UUID16: 0x%04x", uuid->uuid.uuid16);
+            DLOGI(TAG, "UUID16: 0x%04x", uuid->uuid.uuid16);
         }
 
         if (uuid->len == ESP_UUID_LEN_32)
         {
-            ESP_LOGI(TAG, "UUID32: 0x%08lx", uuid->uuid.uuid32);
+            DLOGI(TAG, "UUID32: 0x%08lx", uuid->uuid.uuid32);
         }
 
         if (uuid->len == ESP_UUID_LEN_128)
@@ -235,13 +775,13 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
             uuid128_to_string(uuid->uuid.uuid128, uuid128_str, sizeof(uuid128_str));
             ESP_LOGI(TAG, "UUID128 (LE): %s", uuid128_str);
         }
-        if (p_data->search_res.srvc_id.uuid.len == ESP_UUID_LEN_16 && p_data->search_res.srvc_id.uuid.uuid.uuid16 == SCALE_SERVICE_UUID)
+        if (scale_uuid_equal(&p_data->search_res.srvc_id.uuid, &c->driver->service_uuid))
         {
-            ESP_LOGI(TAG, "*** Service found ***");
-            get_server = true;
-            gl_profile_tab[PROFILE_A_APP_ID].service_start_handle = p_data->search_res.start_handle;
-            gl_profile_tab[PROFILE_A_APP_ID].service_end_handle = p_data->search_res.end_handle;
-            ESP_LOGI(TAG, "UUID16: %x", p_data->search_res.srvc_id.uuid.uuid.uuid16);
+            DLOGI(TAG, "*** Service found ***");
+            c->get_server = true;
+            c->service_start_handle = p_data->search_res.start_handle;
+            c->service_end_handle = p_data->search_res.end_handle;
+            DLOGI(TAG, "Scale protocol %s", c->driver->name);
 
             // Get all characteristics
         }
@@ -249,6 +789,12 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
     }
 
     case ESP_GATTC_SEARCH_CMPL_EVT:
+    {
+        c = find_conn_by_id(p_data->search_cmpl.conn_id);
+        if (c == NULL)
+        {
+            break;
+        }
         if (p_data->search_cmpl.status != ESP_GATT_OK)
         {
             ESP_LOGE(TAG, "Service search failed, status %x", p_data->search_cmpl.status);
@@ -256,187 +802,183 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
         }
         if (p_data->search_cmpl.searched_service_source == ESP_GATT_SERVICE_FROM_REMOTE_DEVICE)
         {
-            ESP_LOGI(TAG, "Get service information from remote device");
+            DLOGI(TAG, "Get service information from remote device");
         }
         else if (p_data->search_cmpl.searched_service_source == ESP_GATT_SERVICE_FROM_NVS_FLASH)
         {
-            ESP_LOGI(TAG, "Get service information from flash");
+            DLOGI(TAG, "Get service information from flash");
         }
         else
         {
-            ESP_LOGI(TAG, "Unknown service source");
+            DLOGI(TAG, "Unknown service source");
+        }
+        DLOGI(TAG, "Service search complete");
+        if (!c->get_server)
+        {
+            ESP_LOGE(TAG, "no service found");
+            break;
         }
-        ESP_LOGI(TAG, "Service search complete");
-        if (get_server)
+        // each scale has one characteristic per UUID, the first match is all we need
+        esp_gattc_char_elem_t char_elem;
+        uint16_t count = 1;
+        esp_gatt_status_t status = esp_ble_gattc_get_char_by_uuid(gattc_if,
+                                                                  p_data->search_cmpl.conn_id,
+                                                                  c->service_start_handle,
+                                                                  c->service_end_handle,
+                                                                  c->driver->command_char_uuid,
+                                                                  &char_elem,
+                                                                  &count);
+        if (status != ESP_GATT_OK || count == 0)
         {
-            uint16_t count = 0;
-            esp_gatt_status_t status = esp_ble_gattc_get_attr_count(gattc_if,
-                                                                    p_data->search_res.conn_id,
-                                                                    ESP_GATT_DB_CHARACTERISTIC,
-                                                                    gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                                    gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                                    INVALID_HANDLE,
-                                                                    &count);
-            if (status != ESP_GATT_OK)
+            ESP_LOGE(TAG, "esp_ble_gattc_get_char_by_uuid error");
+            break;
+        }
+        c->set_char_handle = char_elem.char_handle;
+        DLOGI(TAG, "set charac handle: %d, gattc_if: %d", c->set_char_handle, gl_profile_tab[PROFILE_A_APP_ID].gattc_if);
+
+        count = 1;
+        status = esp_ble_gattc_get_char_by_uuid(gattc_if,
+                                                p_data->search_cmpl.conn_id,
+                                                c->service_start_handle,
+                                                c->service_end_handle,
+                                                c->driver->notify_char_uuid,
+                                                &char_elem,
+                                                &count);
+        if (status != ESP_GATT_OK || count == 0)
+        {
+            ESP_LOGE(TAG, "esp_ble_gattc_get_char_by_uuid error");
+            break;
+        }
+        c->notify_char_handle = char_elem.char_handle;
+        c->notify_registering = true;
+        esp_ble_gattc_register_for_notify(gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
+                                          c->remote_bda,
+                                          c->notify_char_handle);
+        DLOGI(TAG, "notify charac handle: %d, gattc_if: %d", c->notify_char_handle, gl_profile_tab[PROFILE_A_APP_ID].gattc_if);
+
+        init_scale(c);
+        break;
+    }
+    case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+    {
+        // the event carries no connection, registrations complete in the order they were requested
+        for (int i = 0; c == NULL && i < SCALE_MAX; i++)
+        {
+            if (conns[i].connect && conns[i].notify_registering)
             {
-                ESP_LOGE(TAG, "esp_ble_gattc_get_attr_count error");
-                break;
+                c = &conns[i];
+                c->notify_registering = false;
             }
-
-            if (count > 1)
+        }
+        if (c == NULL)
+        {
+            break;
+        }
+        if (p_data->reg_for_notify.status != ESP_GATT_OK)
+        {
+            ESP_LOGE(TAG, "Notification register failed, status %d", p_data->reg_for_notify.status);
+            // the cached handles may be wrong, drop the link and discover from scratch next time
+            if (c->cache_valid)
             {
-                ESP_LOGI(TAG, "Found %d characteristics", count);
-                char_elem_result = (esp_gattc_char_elem_t *)malloc(sizeof(esp_gattc_char_elem_t) * count);
-                if (!char_elem_result)
-                {
-                    ESP_LOGE(TAG, "gattc no mem");
-                    break;
-                }
-                else
-                {
-                    // Get Set Characteristic (allows to set Tare)
-                    status = esp_ble_gattc_get_char_by_uuid(gattc_if,
-                                                            p_data->search_cmpl.conn_id,
-                                                            gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                            gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                            set_char_uuid,
-                                                            char_elem_result,
-                                                            &count);
-                    if (status != ESP_GATT_OK)
-                    {
-                        ESP_LOGE(TAG, "esp_ble_gattc_get_char_by_uuid error");
-                        free(char_elem_result);
-                        char_elem_result = NULL;
-                        break;
-                    }
-                    gl_profile_tab[PROFILE_A_APP_ID].set_char_handle = char_elem_result[0].char_handle;
-                    ESP_LOGI(TAG, "set charac handle: %d, gattc_if: %d", gl_profile_tab[PROFILE_A_APP_ID].set_char_handle, gl_profile_tab[PROFILE_A_APP_ID].gattc_if);
-
-                    // Get Notification Characteristic (that sends the weight)
-                    status = esp_ble_gattc_get_char_by_uuid(gattc_if,
-                                                            p_data->search_cmpl.conn_id,
-                                                            gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                            gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                            notify_char_uuid,
-                                                            char_elem_result,
-                                                            &count);
-                    if (status != ESP_GATT_OK)
-                    {
-                        ESP_LOGE(TAG, "esp_ble_gattc_get_char_by_uuid error");
-                        free(char_elem_result);
-                        char_elem_result = NULL;
-                        break;
-                    }
-                    gl_profile_tab[PROFILE_A_APP_ID].notify_char_handle = char_elem_result[0].char_handle;
-                    status = esp_ble_gattc_register_for_notify(
-                        gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
-                        gl_profile_tab[PROFILE_A_APP_ID].remote_bda,
-                        gl_profile_tab[PROFILE_A_APP_ID].notify_char_handle);
-
-                    ESP_LOGI(TAG, "notify charac handle: %d, gattc_if: %d", gl_profile_tab[PROFILE_A_APP_ID].notify_char_handle, gl_profile_tab[PROFILE_A_APP_ID].gattc_if);
-
-                    init_scale();
-                    /*  Every service have only one char in our 'ESP_GATTS_DEMO' demo, so we used first 'char_elem_result' */
-                    // if (count > 0 && (char_elem_result[0].properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY))
-                    // {
-                    //     gl_profile_tab[PROFILE_A_APP_ID].char_handle = char_elem_result[0].char_handle;
-                    //     esp_ble_gattc_register_for_notify(gattc_if, gl_profile_tab[PROFILE_A_APP_ID].remote_bda, char_elem_result[0].char_handle);
-                    // }
-                }
-                /* free char_elem_result */
-                free(char_elem_result);
+                drop_cached_link(gattc_if, c);
             }
-            else
+        }
+        else if (c->cache_valid)
+        {
+            DLOGI(TAG, "Notification register successfully");
+            enable_notify(gattc_if, c);
+        }
+        else
+        {
+            DLOGI(TAG, "Notification register successfully");
+            esp_gattc_descr_elem_t descr_elem;
+            uint16_t count = 1;
+            esp_gatt_status_t ret_status = esp_ble_gattc_get_descr_by_char_handle(gattc_if,
+                                                                                 c->conn_id,
+                                                                                 p_data->reg_for_notify.handle,
+                                                                                 notify_descr_uuid,
+                                                                                 &descr_elem,
+                                                                                 &count);
+            if (ret_status != ESP_GATT_OK || count == 0)
             {
-                ESP_LOGE(TAG, "no char found");
+                ESP_LOGE(TAG, "decsr not found");
+                break;
             }
+            c->ccc_handle = descr_elem.handle;
+            c->cache_valid = true;
+            store_handles(c);
+            enable_notify(gattc_if, c);
         }
         break;
-    case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+    }
+    case ESP_GATTC_NOTIFY_EVT:
     {
-        if (p_data->reg_for_notify.status != ESP_GATT_OK)
+        c = find_conn_by_id(p_data->notify.conn_id);
+        if (c == NULL)
         {
-            ESP_LOGE(TAG, "Notification register failed, status %d", p_data->reg_for_notify.status);
+            break;
         }
-        else
+        // the cup scale drives the shot, the dose scale only provides its weight
+        bool cup = c == &conns[SCALE_CUP];
+        uint8_t *buf = p_data->notify.value;
+#if SCALE_DRIVER_DECENT
+        // phones expect Decent packets, pass them on untouched
+        bool relay_raw = cup && c->driver == &scale_driver_decent;
+#else
+        bool relay_raw = false;
+#endif
+        if (relay_raw)
+        {
+            ble_relay_forward(buf, p_data->notify.value_len);
+        }
+        if (!c->airtime_logged)
+        {
+            c->airtime_logged = true;
+            DLOGI(TAG, "Scale %d notification of %d bytes is %lu us on air, %d byte PDUs", (int)(c - conns),
+                  p_data->notify.value_len, notify_airtime_us(c, p_data->notify.value_len), c->rx_octets);
+        }
+        int16_t weight10;
+        if (c->driver->decode(buf, p_data->notify.value_len, &weight10))
         {
-            ESP_LOGI(TAG, "Notification register successfully");
-            uint16_t count = 0;
-            uint16_t notify_en = 1;
-            esp_gatt_status_t ret_status = esp_ble_gattc_get_attr_count(gattc_if,
-                                                                        gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                        ESP_GATT_DB_DESCRIPTOR,
-                                                                        gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                                        gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                                        gl_profile_tab[PROFILE_A_APP_ID].notify_char_handle,
-                                                                        &count);
-            if (ret_status != ESP_GATT_OK)
+            // ESP_LOGI(TAG, "Weight: %d", weight10);
+            push_sample(c, weight10);
+            if (c->state != SCALE_STATE_STREAMING)
             {
-                ESP_LOGE(TAG, "esp_ble_gattc_get_attr_count error");
-                break;
+                set_state(c, SCALE_STATE_STREAMING);
+                c->backoff_ms = 0;
             }
-            if (count > 0)
+            // stamped before the listener wakes the controller, which may consume the sample at once
+            if (cup)
             {
-                descr_elem_result = malloc(sizeof(esp_gattc_descr_elem_t) * count);
-                if (!descr_elem_result)
-                {
-                    ESP_LOGE(TAG, "malloc error, gattc no mem");
-                    break;
-                }
-                else
-                {
-                    ret_status = esp_ble_gattc_get_descr_by_char_handle(gattc_if,
-                                                                        gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                        p_data->reg_for_notify.handle,
-                                                                        notify_descr_uuid,
-                                                                        descr_elem_result,
-                                                                        &count);
-                    if (ret_status != ESP_GATT_OK)
-                    {
-                        ESP_LOGE(TAG, "esp_ble_gattc_get_descr_by_char_handle error");
-                        free(descr_elem_result);
-                        descr_elem_result = NULL;
-                        break;
-                    }
-                    /* Every char has only one descriptor in our 'ESP_GATTS_DEMO' demo, so we used first 'descr_elem_result' */
-                    if (count > 0 && descr_elem_result[0].uuid.len == ESP_UUID_LEN_16 && descr_elem_result[0].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG)
-                    {
-                        ret_status = esp_ble_gattc_write_char_descr(gattc_if,
-                                                                    gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                    descr_elem_result[0].handle,
-                                                                    sizeof(notify_en),
-                                                                    (uint8_t *)&notify_en,
-                                                                    ESP_GATT_WRITE_TYPE_RSP,
-                                                                    ESP_GATT_AUTH_REQ_NONE);
-                    }
-
-                    if (ret_status != ESP_GATT_OK)
-                    {
-                        ESP_LOGE(TAG, "esp_ble_gattc_write_char_descr error");
-                    }
-
-                    /* free descr_elem_result */
-                    free(descr_elem_result);
-                }
+                latency_trace_notify();
             }
-            else
+            if (weight_listener != NULL)
             {
-                ESP_LOGE(TAG, "decsr not found");
+                weight_listener((scale_id_t)(c - conns));
+            }
+            if (cup)
+            {
+                shot_log_sample(weight10);
+                usb_stream_weight(weight10);
+                if (!relay_raw)
+                {
+                    ble_relay_weight(weight10);
+                }
             }
         }
+
         break;
     }
-    case ESP_GATTC_NOTIFY_EVT:
-        uint8_t *buf = p_data->notify.value;
-        if (p_data->notify.value_len > 3 && buf[1] != 0xaa)
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        c = find_conn_by_id(p_data->write.conn_id);
+        if (c != NULL && p_data->write.status != ESP_GATT_OK)
         {
-            uint16_t highByte = (uint16_t)buf[2];
-            uint16_t lowByte = (uint16_t)buf[3];
-            int16_t weight10 = (highByte << 8) + lowByte;
-            // ESP_LOGI(TAG, "Weight: %d", weight10);
-            set_weight10(weight10);
+            ESP_LOGE(TAG, "Enabling notifications failed, status %x", p_data->write.status);
+            if (c->cache_valid)
+            {
+                drop_cached_link(gattc_if, c);
+            }
         }
-
         break;
     // case ESP_GATTC_WRITE_DESCR_EVT:
     //     if (p_data->write.status != ESP_GATT_OK)
@@ -463,46 +1005,92 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
         esp_bd_addr_t bda;
         memcpy(bda, p_data->srvc_chg.remote_bda, sizeof(esp_bd_addr_t));
         ESP_LOGI(TAG, "Service change from " ESP_BD_ADDR_STR "", ESP_BD_ADDR_HEX(bda));
+        // the stack discovers again, refreshes its NVS cache and the DIS_SRVC_CMPL event runs the full search
+        c = find_conn_by_bda(bda);
+        if (c != NULL)
+        {
+            invalidate_handles(c);
+        }
         break;
     }
     case ESP_GATTC_WRITE_CHAR_EVT:
-        if (p_data->write.status != ESP_GATT_OK)
+        c = find_conn_by_id(p_data->write.conn_id);
+        if (c == NULL)
         {
-            ESP_LOGE(TAG, "Characteristic write failed, status %x)", p_data->write.status);
             break;
         }
-        ESP_LOGI(TAG, "Characteristic write successfully with handle: %d", gl_profile_tab[PROFILE_A_APP_ID].set_char_handle);
+        if (p_data->write.status == ESP_GATT_INVALID_HANDLE && c->cache_valid)
+        {
+            ESP_LOGE(TAG, "Cached handle %d is gone, discovering again", c->set_char_handle);
+            drop_cached_link(gattc_if, c);
+        }
+        else if (p_data->write.status != ESP_GATT_OK)
+        {
+            ESP_LOGE(TAG, "Characteristic write failed, status %x)", p_data->write.status);
+        }
+        else
+        {
+            DLOGI(TAG, "Characteristic write successfully with handle: %d", c->set_char_handle);
+        }
+        send_next_command(c);
         break;
     case ESP_GATTC_DISCONNECT_EVT:
-        connect = false;
-        get_server = false;
+        c = find_conn_by_bda(p_data->disconnect.remote_bda);
+        if (c == NULL)
+        {
+            break;
+        }
+        c->connect = false;
+        c->get_server = false;
+        c->notify_registering = false;
+        c->conn_interval_ms = 0;
+        if (!c->cache_valid)
+        {
+            c->set_char_handle = INVALID_HANDLE;
+        }
+        reset_commands(c);
         ESP_LOGI(TAG, "Disconnected, remote " ESP_BD_ADDR_STR ", reason 0x%02x",
                  ESP_BD_ADDR_HEX(p_data->disconnect.remote_bda), p_data->disconnect.reason);
+        if (scanning_wanted)
+        {
+            enter_backoff(c);
+        }
+        else
+        {
+            set_state(c, SCALE_STATE_IDLE);
+        }
         break;
     default:
         break;
     }
 }
 
-static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+static void handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
-    uint8_t *adv_name = NULL;
-    uint8_t adv_name_len = 0;
     switch (event)
     {
     case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
     {
-        esp_ble_gap_start_scanning(0);
+        if (param->scan_param_cmpl.status != ESP_BT_STATUS_SUCCESS ||
+            esp_ble_gap_start_scanning(scan_known ? SCALE_KNOWN_SCAN_SECONDS : scan_duration_s) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Scan params failed, status %x", param->scan_param_cmpl.status);
+            scan_starting = false;
+        }
         break;
     }
     case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
         // scan start complete event to indicate scan start successfully or failed
+        scan_starting = false;
         if (param->scan_start_cmpl.status != ESP_BT_STATUS_SUCCESS)
         {
             ESP_LOGE(TAG, "Scanning start failed, status %x", param->scan_start_cmpl.status);
             break;
         }
-        ESP_LOGI(TAG, "Scanning start successfully");
+        scanning = true;
+        scan_matched = false;
+        scan_start_us = esp_timer_get_time();
+        DLOGI(TAG, "Scanning start successfully, %s", scan_known ? "known scales" : "all devices");
 
         break;
     case ESP_GAP_BLE_SCAN_RESULT_EVT:
@@ -511,14 +1099,19 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
         switch (scan_result->scan_rst.search_evt)
         {
         case ESP_GAP_SEARCH_INQ_RES_EVT:
-            adv_name = esp_ble_resolve_adv_data_by_type(scan_result->scan_rst.ble_adv,
-                                                        scan_result->scan_rst.adv_data_len + scan_result->scan_rst.scan_rsp_len,
-                                                        ESP_BLE_AD_TYPE_NAME_CMPL,
-                                                        &adv_name_len);
+        {
+            // results already queued when the scan was stopped
+            if (scan_matched)
+            {
+                break;
+            }
+            uint16_t adv_len = scan_result->scan_rst.adv_data_len + scan_result->scan_rst.scan_rsp_len;
+#if SCALE_SCAN_DEBUG
+            uint8_t adv_name_len = 0;
+            uint8_t *adv_name = esp_ble_resolve_adv_data_by_type(scan_result->scan_rst.ble_adv, adv_len,
+                                                                 ESP_BLE_AD_TYPE_NAME_CMPL, &adv_name_len);
             ESP_LOGI(TAG, "Scan result, device " ESP_BD_ADDR_STR ", name len %u", ESP_BD_ADDR_HEX(scan_result->scan_rst.bda), adv_name_len);
             ESP_LOG_BUFFER_CHAR(TAG, adv_name, adv_name_len);
-
-#if CONFIG_EXAMPLE_DUMP_ADV_DATA_AND_SCAN_RESP
             if (scan_result->scan_rst.adv_data_len > 0)
             {
                 ESP_LOGI(TAG, "adv data:");
@@ -531,32 +1124,80 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
             }
 #endif
 
-            if (adv_name != NULL)
+            // a known address keeps its driver, everything else is matched by scale_driver_from_adv.
+            // The relay of another remote looks like a Decent Scale, its marker gives it away.
+            if (ble_relay_is_relay_adv(scan_result->scan_rst.ble_adv, adv_len))
+            {
+                break;
+            }
+            scale_conn_t *known = find_conn_by_bda(scan_result->scan_rst.bda);
+            const scale_driver_t *driver = known != NULL && known->driver != NULL
+                                               ? known->driver
+                                               : scale_driver_from_adv(scan_result->scan_rst.ble_adv, adv_len);
+            if (driver == NULL)
             {
-                if (strlen(remote_device_name) == adv_name_len && strncmp((char *)adv_name, remote_device_name, adv_name_len) == 0)
+                break;
+            }
+            // Note: If there are multiple devices with the same device name, the device may connect to an unintended one.
+            // It is recommended to change the default device name to ensure it is unique.
+            scale_conn_t *c = bind_conn(scan_result->scan_rst.bda);
+            if (c != NULL && c->connect == false)
+            {
+                ESP_LOGI(TAG, "Device found " ESP_BD_ADDR_STR " after %lld ms, protocol %s",
+                         ESP_BD_ADDR_HEX(scan_result->scan_rst.bda), (esp_timer_get_time() - scan_start_us) / 1000, driver->name);
+                scan_matched = true;
+                esp_timer_stop(c->reconnect_timer);
+                set_state(c, SCALE_STATE_CONNECTING);
+                if (c->driver != driver)
+                {
+                    c->cache_valid = false;
+                }
+                c->driver = driver;
+                if (!c->cache_valid)
                 {
-                    // Note: If there are multiple devices with the same device name, the device may connect to an unintended one.
-                    // It is recommended to change the default device name to ensure it is unique.
-                    if (connect == false)
-                    {
-                        ESP_LOGI(TAG, "Device found %s", remote_device_name);
-                        connect = true;
-                        ESP_LOGI(TAG, "Connect to the remote device");
-                        esp_ble_gap_stop_scanning();
-                        esp_ble_gatt_creat_conn_params_t creat_conn_params = {0};
-                        memcpy(&creat_conn_params.remote_bda, scan_result->scan_rst.bda, ESP_BD_ADDR_LEN);
-                        creat_conn_params.remote_addr_type = scan_result->scan_rst.ble_addr_type;
-                        creat_conn_params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
-                        creat_conn_params.is_direct = true;
-                        creat_conn_params.is_aux = false;
-                        creat_conn_params.phy_mask = 0x0;
-                        esp_ble_gattc_enh_open(gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
-                                               &creat_conn_params);
-                    }
+                    load_handles(c);
                 }
+                c->remote_addr_type = scan_result->scan_rst.ble_addr_type;
+                c->connect = true;
+                DLOGI(TAG, "Connect to the remote device");
+                esp_ble_gap_stop_scanning();
+                esp_ble_gatt_creat_conn_params_t creat_conn_params = {0};
+                memcpy(&creat_conn_params.remote_bda, scan_result->scan_rst.bda, ESP_BD_ADDR_LEN);
+                creat_conn_params.remote_addr_type = scan_result->scan_rst.ble_addr_type;
+                creat_conn_params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+                creat_conn_params.is_direct = true;
+                creat_conn_params.is_aux = false;
+                creat_conn_params.phy_mask = 0x0;
+                esp_ble_gattc_enh_open(gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
+                                       &creat_conn_params);
             }
             break;
+        }
         case ESP_GAP_SEARCH_INQ_CMPL_EVT:
+            // scan duration is over. The known scales are not around, look for new ones
+            scanning = false;
+            if (scan_known && scanning_wanted && slot_available())
+            {
+                DLOGI(TAG, "No known scale found, scanning for new ones");
+                start_scan(scan_duration_s);
+                break;
+            }
+            // scales that were connected before keep trying, free slots wait for the next ON
+            for (int i = 0; i < SCALE_MAX; i++)
+            {
+                if (conns[i].state != SCALE_STATE_SCANNING)
+                {
+                    continue;
+                }
+                if (conns[i].in_use && scanning_wanted)
+                {
+                    enter_backoff(&conns[i]);
+                }
+                else
+                {
+                    set_state(&conns[i], SCALE_STATE_IDLE);
+                }
+            }
             break;
         default:
             break;
@@ -565,42 +1206,80 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
     }
 
     case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+        scanning = false;
         if (param->scan_stop_cmpl.status != ESP_BT_STATUS_SUCCESS)
         {
             ESP_LOGE(TAG, "Scanning stop failed, status %x", param->scan_stop_cmpl.status);
             break;
         }
-        ESP_LOGI(TAG, "Scanning stop successfully");
+        DLOGI(TAG, "Scanning stop successfully");
         break;
 
+    case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
+    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+        ble_relay_gap_event(event, param);
+        break;
     case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
         if (param->adv_stop_cmpl.status != ESP_BT_STATUS_SUCCESS)
         {
             ESP_LOGE(TAG, "Advertising stop failed, status %x", param->adv_stop_cmpl.status);
             break;
         }
-        ESP_LOGI(TAG, "Advertising stop successfully");
+        DLOGI(TAG, "Advertising stop successfully");
         break;
     case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
-        ESP_LOGI(TAG, "Connection params update, status %d, conn_int %d, latency %d, timeout %d",
-                 param->update_conn_params.status,
-                 param->update_conn_params.conn_int,
-                 param->update_conn_params.latency,
-                 param->update_conn_params.timeout);
+    {
+        scale_conn_t *c = find_conn_by_bda(param->update_conn_params.bda);
+        if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS && c != NULL)
+        {
+            c->conn_interval_ms = param->update_conn_params.conn_int * 5 / 4; // unit is 1.25 ms
+            // an update the scale asked for on its own is the interval it wants
+            if (!c->interval_requested)
+            {
+                c->peer_interval_ms = c->conn_interval_ms;
+            }
+        }
+        if (c != NULL)
+        {
+            c->interval_requested = false;
+        }
+        DLOGI(TAG, "Connection params update, status %d, conn_int %d, latency %d, timeout %d",
+              param->update_conn_params.status,
+              param->update_conn_params.conn_int,
+              param->update_conn_params.latency,
+              param->update_conn_params.timeout);
         break;
+    }
     case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
-        ESP_LOGI(TAG, "Packet length update, status %d, rx %d, tx %d",
-                 param->pkt_data_length_cmpl.status,
-                 param->pkt_data_length_cmpl.params.rx_len,
-                 param->pkt_data_length_cmpl.params.tx_len);
+    {
+        DLOGI(TAG, "Packet length update, status %d, rx %d, tx %d",
+              param->pkt_data_length_cmpl.status,
+              param->pkt_data_length_cmpl.params.rx_len,
+              param->pkt_data_length_cmpl.params.tx_len);
+        // the event has no address, requests complete in the order they were made
+        for (int i = 0; i < SCALE_MAX; i++)
+        {
+            scale_conn_t *c = &conns[i];
+            if (c->connect && c->dle_pending)
+            {
+                c->dle_pending = false;
+                if (param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS)
+                {
+                    c->rx_octets = param->pkt_data_length_cmpl.params.rx_len;
+                    c->airtime_logged = false;
+                }
+                break;
+            }
+        }
         break;
+    }
     default:
         break;
     }
 }
 
 // Main GATT handler
-static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+static void handle_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
 {
     // ESP_LOGI(TAG, "esp_gattc_cb() called");
     /* If event is register event, store the gattc_if for each profile */
@@ -612,9 +1291,9 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
         }
         else
         {
-            ESP_LOGI(TAG, "reg app failed, app_id %04x, status %d",
-                     param->reg.app_id,
-                     param->reg.status);
+            DLOGI(TAG, "reg app failed, app_id %04x, status %d",
+                  param->reg.app_id,
+                  param->reg.status);
             return;
         }
     }
@@ -638,21 +1317,68 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
     } while (0);
 }
 
-void bt_connect_scale(void)
+static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
-    if (gl_profile_tab[0].gattc_if != ESP_GATT_IF_NONE)
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    handle_gap_event(event, param);
+    xSemaphoreGive(link_lock);
+}
+
+static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+{
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    handle_gattc_event(event, gattc_if, param);
+    xSemaphoreGive(link_lock);
+}
+
+// Reopens the first known scale, its open event starts the scan for the other one
+static void reopen_known_scale(void)
+{
+    for (int i = 0; i < SCALE_MAX; i++)
     {
-        esp_err_t ret = esp_ble_gattc_open(
-            gl_profile_tab[0].gattc_if,
-            gl_profile_tab[0].remote_bda,
-            BLE_ADDR_TYPE_PUBLIC,
-            true);
-        if (ret == ESP_OK)
+        scale_conn_t *c = &conns[i];
+        if (c->in_use && !c->connect)
         {
-            connect = true;
+            esp_timer_stop(c->reconnect_timer);
+            set_state(c, SCALE_STATE_CONNECTING);
+            esp_err_t ret = esp_ble_gattc_open(
+                gl_profile_tab[0].gattc_if,
+                c->remote_bda,
+                c->remote_addr_type,
+                true);
+            if (ret == ESP_OK)
+            {
+                c->connect = true;
+            }
+            else
+            {
+                enter_backoff(c);
+            }
+            return;
         }
+    }
+    start_scan(SCALE_RESCAN_SECONDS);
+}
+
+void bt_connect_scale(void)
+{
+    if (link_lock == NULL)
+    {
+        link_lock = xSemaphoreCreateMutexStatic(&link_lock_buf);
+    }
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    scanning_wanted = true;
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        conns[i].backoff_ms = 0;
+    }
+    if (gl_profile_tab[0].gattc_if != ESP_GATT_IF_NONE)
+    {
+        reopen_known_scale();
+        xSemaphoreGive(link_lock);
         return;
     }
+    xSemaphoreGive(link_lock);
 
     // Initialize NVS.
     esp_err_t ret = nvs_flash_init();
@@ -710,24 +1436,37 @@ void bt_connect_scale(void)
         return;
     }
 
+    const esp_timer_create_args_t heartbeat_args = {
+        .callback = heartbeat_cb,
+        .name = "scale_heartbeat",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&heartbeat_args, &heartbeat_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(heartbeat_timer, SCALE_HEARTBEAT_TICK_MS * 1000));
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        const esp_timer_create_args_t reconnect_args = {
+            .callback = reconnect_cb,
+            .arg = &conns[i],
+            .name = "scale_reconnect",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&reconnect_args, &conns[i].reconnect_timer));
+    }
+
     ret = esp_ble_gattc_app_register(PROFILE_A_APP_ID);
     if (ret)
     {
         ESP_LOGE(TAG, "%s gattc app register failed, error code = %x", __func__, ret);
     }
 
+    ble_relay_init();
+
     esp_err_t local_mtu_ret = esp_ble_gatt_set_local_mtu(500);
     if (local_mtu_ret)
     {
         ESP_LOGE(TAG, "set local  MTU failed, error code = %x", local_mtu_ret);
     }
 
-    ret = esp_ble_gap_set_scan_params(&ble_scan_params);
-    if (ret)
-    {
-        ESP_LOGE(TAG, "Set scan params failed: %s", esp_err_to_name(ret));
-        return;
-    }
+    // scanning starts with the GATT client register event
 
     /*
      * This code is intended for debugging and prints all HCI data.
@@ -748,15 +1487,34 @@ void bt_connect_scale(void)
     */
 }
 
-void disconnect_from_scale(void)
+static void close_links(void)
 {
-    if (connect)
+    scanning_wanted = false;
+    esp_ble_gap_stop_scanning();
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        esp_timer_stop(conns[i].reconnect_timer);
+        if (!conns[i].connect)
+        {
+            set_state(&conns[i], SCALE_STATE_IDLE);
+        }
+    }
+    if (!scale_is_connected())
+    {
+        ESP_LOGW(TAG, "Not connected to any device");
+        return;
+    }
+    for (int i = 0; i < SCALE_MAX; i++)
     {
-        ESP_LOGI(TAG, "Disconnecting from device...");
+        if (!conns[i].connect)
+        {
+            continue;
+        }
+        DLOGI(TAG, "Disconnecting from scale %d...", i);
 
         esp_err_t ret = esp_ble_gattc_close(
             gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
-            gl_profile_tab[PROFILE_A_APP_ID].conn_id);
+            conns[i].conn_id);
 
         if (ret != ESP_OK)
         {
@@ -764,77 +1522,129 @@ void disconnect_from_scale(void)
         }
         else
         {
-            ESP_LOGI(TAG, "Disconnect request sent");
+            DLOGI(TAG, "Disconnect request sent");
         }
     }
-    else
+}
+
+void disconnect_from_scale(void)
+{
+    if (link_lock == NULL)
     {
-        ESP_LOGW(TAG, "Not connected to any device");
+        return;
     }
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    close_links();
+    xSemaphoreGive(link_lock);
 }
 
-void write_char(uint8_t write_data[])
+static void request_conn_interval(scale_conn_t *c, uint16_t interval_ms)
 {
-    esp_err_t ret = esp_ble_gattc_write_char(
-        gl_profile_tab[PROFILE_A_APP_ID].gattc_if,
-        gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-        gl_profile_tab[PROFILE_A_APP_ID].set_char_handle,
-        7, // don't use sizeof(write_data) here because it will be 4 (sizeof pointer type)
-        write_data,
-        ESP_GATT_WRITE_TYPE_RSP,
-        ESP_GATT_AUTH_REQ_NONE);
+    esp_ble_conn_update_params_t conn_params = {0};
+    memcpy(conn_params.bda, c->remote_bda, sizeof(esp_bd_addr_t));
+    conn_params.min_int = interval_ms * 4 / 5; // unit is 1.25 ms
+    conn_params.max_int = interval_ms * 4 / 5;
+    conn_params.latency = 0;
+    // the spec wants the timeout above twice the interval, a fixed 4 s would refuse intervals from 2 s up
+    uint32_t timeout_ms = (uint32_t)interval_ms * SCALE_SUPERVISION_INTERVALS;
+    conn_params.timeout = (timeout_ms < SCALE_SUPERVISION_MIN_MS ? SCALE_SUPERVISION_MIN_MS : timeout_ms) / 10; // unit is 10 ms
+    esp_err_t ret = esp_ble_gap_update_conn_params(&conn_params);
     if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Write to set charact with handle %d failed", gl_profile_tab[PROFILE_A_APP_ID].set_char_handle);
+        ESP_LOGE(TAG, "Connection interval update failed: %s", esp_err_to_name(ret));
+        return;
+    }
+    c->interval_requested = true;
+}
+
+// Ask the scales for a different connection interval. Longer intervals save power on both ends
+// at the cost of notification latency.
+void scale_set_conn_interval(uint16_t interval_ms)
+{
+    if (interval_ms == 0)
+    {
+        return;
+    }
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        if (conns[i].connect)
+        {
+            request_conn_interval(&conns[i], interval_ms);
+        }
+    }
+}
+
+// Go back to the interval each scale had before scale_set_conn_interval changed it
+void scale_restore_conn_interval(void)
+{
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        scale_conn_t *c = &conns[i];
+        if (c->connect && c->peer_interval_ms != 0 && c->conn_interval_ms != c->peer_interval_ms)
+        {
+            request_conn_interval(c, c->peer_interval_ms);
+        }
+    }
+}
+
+// Commands for both scales, the timer only exists on the cup scale
+static void send_to_all(scale_cmd_t cmd)
+{
+    for (int i = 0; i < SCALE_MAX; i++)
+    {
+        if (conns[i].connect)
+        {
+            queue_command(&conns[i], cmd);
+        }
     }
 }
 
 void scale_tare()
 {
-    ESP_LOGI(TAG, "Sending TARE to scale");
-    write_char(tare);
+    DLOGI(TAG, "Sending TARE to scale");
+    send_to_all(SCALE_CMD_TARE);
 }
 
 void scale_led_on_gram()
 {
-    ESP_LOGI(TAG, "Sending LED_ON_GRAM to scale");
-    write_char(led_on_gram);
+    DLOGI(TAG, "Sending LED_ON_GRAM to scale");
+    send_to_all(SCALE_CMD_LED_ON_GRAM);
 }
 
 void scale_led_on_ounce()
 {
-    ESP_LOGI(TAG, "Sending LED_ON_OUNCE to scale");
-    write_char(led_on_ounce);
+    DLOGI(TAG, "Sending LED_ON_OUNCE to scale");
+    send_to_all(SCALE_CMD_LED_ON_OUNCE);
 }
 
 void scale_led_off()
 {
-    ESP_LOGI(TAG, "Sending LED_OFF to scale");
-    write_char(led_off);
+    DLOGI(TAG, "Sending LED_OFF to scale");
+    send_to_all(SCALE_CMD_LED_OFF);
 }
 
 void scale_power_off()
 {
-    ESP_LOGI(TAG, "Sending POWER_OFF to scale");
-    write_char(power_off);
+    DLOGI(TAG, "Sending POWER_OFF to scale");
+    send_to_all(SCALE_CMD_POWER_OFF);
 }
 
 void scale_timer_on()
 {
-    ESP_LOGI(TAG, "Sending TIMER ON to scale");
-    write_char(timer_on);
+    DLOGI(TAG, "Sending TIMER ON to scale");
+    scale_send_command(SCALE_CUP, SCALE_CMD_TIMER_START);
 }
 
 void scale_timer_off()
 {
-    ESP_LOGI(TAG, "Sending TIMER OFF to scale");
-    write_char(timer_off);
+    DLOGI(TAG, "Sending TIMER OFF to scale");
+    scale_send_command(SCALE_CUP, SCALE_CMD_TIMER_STOP);
 }
 
 void scale_timer_reset()
 {
-    ESP_LOGI(TAG, "Sending TIMER RESET to scale");
-    write_char(timer_reset);
+    DLOGI(TAG, "Sending TIMER RESET to scale");
+    scale_send_command(SCALE_CUP, SCALE_CMD_TIMER_RESET);
 }
 
 void set_unit(enum unit_t unit)
@@ -1,4 +1,7 @@
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "scale_driver.h"
 
 enum unit_t
 {
@@ -6,6 +9,29 @@ enum unit_t
     OUNCE,
 };
 
+// Up to two scales, the cup scale drives timer and shot log, the dose scale provides the dose
+typedef enum
+{
+    SCALE_CUP,
+    SCALE_DOSE,
+    SCALE_MAX,
+} scale_id_t;
+
+// Life cycle of one scale link. A link that drops while the scales are switched on
+// goes to backoff and is found again by a scan for its address.
+typedef enum
+{
+    SCALE_STATE_IDLE,
+    SCALE_STATE_SCANNING,
+    SCALE_STATE_CONNECTING,
+    SCALE_STATE_DISCOVERING, // connected, looking up handles and enabling notifications
+    SCALE_STATE_STREAMING,   // weights are arriving
+    SCALE_STATE_BACKOFF,     // waiting before the next reconnect attempt
+} scale_state_t;
+
+// Called on the BT task for every decoded weight, must not block
+typedef void (*scale_weight_listener_t)(scale_id_t id);
+
 void bt_connect_scale(void);
 void scale_tare();
 void scale_led_on_gram();
@@ -16,4 +42,17 @@ void scale_timer_on();
 void scale_timer_off();
 void scale_timer_reset();
 int16_t get_weight10();
+int16_t scale_get_weight10(scale_id_t id);
+bool scale_id_connected(scale_id_t id);
+bool scale_is_connected();
+scale_state_t scale_get_state(scale_id_t id);
+bool scale_weight_stale(scale_id_t id);
+int64_t scale_stale_at_us(scale_id_t id);
+uint16_t scale_get_conn_interval_ms();
+uint8_t scale_get_scan_duty_pct(void);
+void scale_set_conn_interval(uint16_t interval_ms);
+void scale_restore_conn_interval(void);
+void scale_send_command(scale_id_t id, scale_cmd_t cmd);
+void scale_set_weight_listener(scale_weight_listener_t listener);
+void scale_log_links(void);
 void set_unit(enum unit_t unit);
\ No newline at end of file
@@ -0,0 +1,425 @@
+/*
+ * GATT server that re-publishes the scale to phones and tablets. The remote holds the single
+ * connection the scale accepts, so it presents itself as a Decent Scale with the same service
+ * and characteristics. Apps that talk to a Decent Scale work unchanged.
+ */
+
+#include <string.h>
+#include "esp_gatts_api.h"
+#include "esp_gatt_defs.h"
+#include "esp_log.h"
+#include "diag/dlog.h"
+#include "ble.h"
+#include "ble_relay.h"
+#include "shot/shot_log.h"
+
+#define RELAY_APP_ID 1
+#define RELAY_MAX_CLIENTS 2
+#define RELAY_DEVICE_NAME "Decent Scale"
+
+#define SCALE_SERVICE_UUID 0xFFF0
+#define WEIGHT_CHAR_UUID 0xFFF4
+#define COMMAND_CHAR_UUID 0x36F5
+#define STATUS_CHAR_UUID 0xFFF5
+
+// Manufacturer data that tells other remotes this is a relay and not a scale. 0xFFFF is the
+// company ID the Bluetooth SIG keeps for tests and internal use, "SR" stands for scale relay.
+#define RELAY_ADV_MARKER 0xff, 0xff, 'S', 'R'
+#define RELAY_ADV_MARKER_LEN 4
+
+// Index of each attribute in the table below
+enum
+{
+    RELAY_IDX_SVC,
+    RELAY_IDX_WEIGHT_CHAR,
+    RELAY_IDX_WEIGHT_VAL,
+    RELAY_IDX_WEIGHT_CCC,
+    RELAY_IDX_COMMAND_CHAR,
+    RELAY_IDX_COMMAND_VAL,
+    RELAY_IDX_STATUS_CHAR,
+    RELAY_IDX_STATUS_VAL,
+    RELAY_IDX_STATUS_CCC,
+    RELAY_IDX_NB,
+};
+
+// Payload of the status characteristic. Not part of the Decent protocol, apps that don't know
+// it simply ignore the extra characteristic.
+typedef struct __attribute__((packed))
+{
+    int16_t weight10;
+    int16_t flow10;      // 0.1 g/s, 0 while no shot is recorded
+    uint16_t seconds;
+    uint8_t timer_running;
+} relay_status_t;
+
+typedef struct
+{
+    bool in_use;
+    uint16_t conn_id;
+    bool weight_notify;
+    bool status_notify;
+} relay_client_t;
+
+static const char *TAG = "ble_relay";
+
+static esp_gatt_if_t relay_gatts_if = ESP_GATT_IF_NONE;
+static uint16_t relay_handles[RELAY_IDX_NB];
+static relay_client_t clients[RELAY_MAX_CLIENTS];
+static volatile uint16_t timer_seconds = 0;
+static volatile bool timer_running = false;
+static volatile bool adv_configured = false;
+static volatile bool adv_allowed = true;
+
+static const uint16_t primary_service_uuid = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t char_decl_uuid = ESP_GATT_UUID_CHAR_DECLARE;
+static const uint16_t char_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+static const uint16_t scale_service_uuid = SCALE_SERVICE_UUID;
+static const uint16_t weight_char_uuid = WEIGHT_CHAR_UUID;
+static const uint16_t command_char_uuid = COMMAND_CHAR_UUID;
+static const uint16_t status_char_uuid = STATUS_CHAR_UUID;
+static const uint8_t char_prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t char_prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+static const uint8_t ccc_default[2] = {0x00, 0x00};
+static uint8_t weight_value[10] = {0};
+static uint8_t command_value[7] = {0};
+static relay_status_t status_value = {0};
+
+static const esp_gatts_attr_db_t relay_db[RELAY_IDX_NB] = {
+    [RELAY_IDX_SVC] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&primary_service_uuid, ESP_GATT_PERM_READ, sizeof(uint16_t), sizeof(scale_service_uuid), (uint8_t *)&scale_service_uuid}},
+
+    [RELAY_IDX_WEIGHT_CHAR] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_decl_uuid, ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t), (uint8_t *)&char_prop_notify}},
+    [RELAY_IDX_WEIGHT_VAL] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&weight_char_uuid, ESP_GATT_PERM_READ, sizeof(weight_value), sizeof(weight_value), weight_value}},
+    [RELAY_IDX_WEIGHT_CCC] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, sizeof(ccc_default), sizeof(ccc_default), (uint8_t *)ccc_default}},
+
+    [RELAY_IDX_COMMAND_CHAR] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_decl_uuid, ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t), (uint8_t *)&char_prop_write}},
+    [RELAY_IDX_COMMAND_VAL] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&command_char_uuid, ESP_GATT_PERM_WRITE, sizeof(command_value), sizeof(command_value), command_value}},
+
+    [RELAY_IDX_STATUS_CHAR] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_decl_uuid, ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t), (uint8_t *)&char_prop_notify}},
+    [RELAY_IDX_STATUS_VAL] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&status_char_uuid, ESP_GATT_PERM_READ, sizeof(status_value), sizeof(status_value), (uint8_t *)&status_value}},
+    [RELAY_IDX_STATUS_CCC] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, sizeof(ccc_default), sizeof(ccc_default), (uint8_t *)ccc_default}},
+};
+
+// flags, complete name and the scale service, so apps filtering on either find us
+static uint8_t adv_data[] = {
+    0x02, ESP_BLE_AD_TYPE_FLAG, ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT,
+    0x0d, ESP_BLE_AD_TYPE_NAME_CMPL, 'D', 'e', 'c', 'e', 'n', 't', ' ', 'S', 'c', 'a', 'l', 'e',
+    0x03, ESP_BLE_AD_TYPE_16SRV_CMPL, SCALE_SERVICE_UUID & 0xff, SCALE_SERVICE_UUID >> 8,
+    RELAY_ADV_MARKER_LEN + 1, ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE, RELAY_ADV_MARKER,
+};
+
+static const uint8_t relay_marker[RELAY_ADV_MARKER_LEN] = {RELAY_ADV_MARKER};
+
+static esp_ble_adv_params_t adv_params = {
+    .adv_int_min = 0x100, // unit is 0.625 ms
+    .adv_int_max = 0x200,
+    .adv_type = ADV_TYPE_IND,
+    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+    .channel_map = ADV_CHNL_ALL,
+    .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+};
+
+// True if the advertisement (and scan response) comes from the relay of a remote like this one
+bool ble_relay_is_relay_adv(const uint8_t *adv, uint16_t adv_len)
+{
+    uint8_t len = 0;
+    const uint8_t *data = esp_ble_resolve_adv_data_by_type((uint8_t *)adv, adv_len, ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE, &len);
+    return data != NULL && len == RELAY_ADV_MARKER_LEN && memcmp(data, relay_marker, RELAY_ADV_MARKER_LEN) == 0;
+}
+
+static relay_client_t *find_client(uint16_t conn_id)
+{
+    for (int i = 0; i < RELAY_MAX_CLIENTS; i++)
+    {
+        if (clients[i].in_use && clients[i].conn_id == conn_id)
+        {
+            return &clients[i];
+        }
+    }
+    return NULL;
+}
+
+static int client_count(void)
+{
+    int count = 0;
+    for (int i = 0; i < RELAY_MAX_CLIENTS; i++)
+    {
+        count += clients[i].in_use;
+    }
+    return count;
+}
+
+static void start_advertising(void)
+{
+    if (adv_configured && adv_allowed && client_count() < RELAY_MAX_CLIENTS)
+    {
+        esp_ble_gap_start_advertising(&adv_params);
+    }
+}
+
+/**
+ * Forward a notification of the scale to every subscribed client. Runs in the Bluetooth task
+ * straight from ESP_GATTC_NOTIFY_EVT, the buffer of the event is handed to the stack as is.
+ */
+void ble_relay_forward(const uint8_t *data, uint16_t len)
+{
+    if (relay_gatts_if == ESP_GATT_IF_NONE)
+    {
+        return;
+    }
+
+    bool status_wanted = false;
+    for (int i = 0; i < RELAY_MAX_CLIENTS; i++)
+    {
+        if (clients[i].in_use && clients[i].weight_notify)
+        {
+            esp_ble_gatts_send_indicate(relay_gatts_if, clients[i].conn_id, relay_handles[RELAY_IDX_WEIGHT_VAL], len, (uint8_t *)data, false);
+        }
+        status_wanted |= clients[i].in_use && clients[i].status_notify;
+    }
+
+    if (!status_wanted || len < 4 || data[1] == 0xaa)
+    {
+        return;
+    }
+    status_value.weight10 = (int16_t)((data[2] << 8) + data[3]);
+    status_value.flow10 = shot_log_flow10();
+    status_value.seconds = timer_seconds;
+    status_value.timer_running = timer_running;
+    for (int i = 0; i < RELAY_MAX_CLIENTS; i++)
+    {
+        if (clients[i].in_use && clients[i].status_notify)
+        {
+            esp_ble_gatts_send_indicate(relay_gatts_if, clients[i].conn_id, relay_handles[RELAY_IDX_STATUS_VAL], sizeof(status_value), (uint8_t *)&status_value, false);
+        }
+    }
+}
+
+// Scales with another protocol are presented as a Decent Scale: 03 ce weight_hi weight_lo 00 00 xor
+void ble_relay_weight(int16_t weight10)
+{
+    uint8_t packet[7] = {0x03, 0xce, (uint8_t)(weight10 >> 8), (uint8_t)weight10, 0x00, 0x00, 0x00};
+    for (int i = 0; i < sizeof(packet) - 1; i++)
+    {
+        packet[6] ^= packet[i];
+    }
+    ble_relay_forward(packet, sizeof(packet));
+}
+
+// The timer state goes out with the next weight notification, the scale notifies continuously
+void ble_relay_timer(uint16_t seconds, bool running)
+{
+    timer_seconds = seconds;
+    timer_running = running;
+}
+
+static bool decent_command(const uint8_t *value, scale_cmd_t *cmd)
+{
+    switch (value[1])
+    {
+    case 0x0f:
+        *cmd = SCALE_CMD_TARE;
+        return true;
+    case 0x0a:
+        // LED off, LED on with the unit in byte 4, or power off
+        if (value[2] == 0x02)
+        {
+            *cmd = SCALE_CMD_POWER_OFF;
+        }
+        else if (value[2] == 0x00)
+        {
+            *cmd = SCALE_CMD_LED_OFF;
+        }
+        else
+        {
+            *cmd = value[4] == 0x01 ? SCALE_CMD_LED_ON_OUNCE : SCALE_CMD_LED_ON_GRAM;
+        }
+        return true;
+    case 0x0b:
+        if (value[2] == 0x03)
+        {
+            *cmd = SCALE_CMD_TIMER_START;
+        }
+        else if (value[2] == 0x02)
+        {
+            *cmd = SCALE_CMD_TIMER_RESET;
+        }
+        else
+        {
+            *cmd = SCALE_CMD_TIMER_STOP;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void handle_write(esp_ble_gatts_cb_param_t *param)
+{
+    relay_client_t *client = find_client(param->write.conn_id);
+    if (client == NULL)
+    {
+        return;
+    }
+    uint16_t handle = param->write.handle;
+    if (handle == relay_handles[RELAY_IDX_WEIGHT_CCC] && param->write.len == 2)
+    {
+        client->weight_notify = param->write.value[0] & 0x01;
+        DLOGI(TAG, "Weight notifications %s, conn_id %d", client->weight_notify ? "on" : "off", client->conn_id);
+    }
+    else if (handle == relay_handles[RELAY_IDX_STATUS_CCC] && param->write.len == 2)
+    {
+        client->status_notify = param->write.value[0] & 0x01;
+        DLOGI(TAG, "Status notifications %s, conn_id %d", client->status_notify ? "on" : "off", client->conn_id);
+    }
+    else if (handle == relay_handles[RELAY_IDX_COMMAND_VAL] && param->write.len == sizeof(command_value))
+    {
+        // apps speak Decent, the driver of the cup scale encodes the command for the real scale
+        DLOGI(TAG, "Command 0x%02x from conn_id %d", param->write.value[1], client->conn_id);
+        scale_cmd_t cmd;
+        if (decent_command(param->write.value, &cmd))
+        {
+            scale_send_command(SCALE_CUP, cmd);
+        }
+    }
+}
+
+static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+    switch (event)
+    {
+    case ESP_GATTS_REG_EVT:
+        if (param->reg.status != ESP_GATT_OK)
+        {
+            ESP_LOGE(TAG, "GATT server register failed, status %d", param->reg.status);
+            break;
+        }
+        relay_gatts_if = gatts_if;
+        esp_ble_gap_set_device_name(RELAY_DEVICE_NAME);
+        esp_ble_gap_config_adv_data_raw(adv_data, sizeof(adv_data));
+        esp_ble_gatts_create_attr_tab(relay_db, gatts_if, RELAY_IDX_NB, 0);
+        break;
+    case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+        if (param->add_attr_tab.status != ESP_GATT_OK || param->add_attr_tab.num_handle != RELAY_IDX_NB)
+        {
+            ESP_LOGE(TAG, "Create attribute table failed, status %d, handles %d", param->add_attr_tab.status, param->add_attr_tab.num_handle);
+            break;
+        }
+        memcpy(relay_handles, param->add_attr_tab.handles, sizeof(relay_handles));
+        esp_ble_gatts_start_service(relay_handles[RELAY_IDX_SVC]);
+        break;
+    case ESP_GATTS_CONNECT_EVT:
+    {
+        // the GATT server sees the connection to the scale as well, only take links where we are peripheral
+        if (param->connect.link_role != 1)
+        {
+            break;
+        }
+        relay_client_t *client = NULL;
+        for (int i = 0; i < RELAY_MAX_CLIENTS && client == NULL; i++)
+        {
+            if (!clients[i].in_use)
+            {
+                client = &clients[i];
+            }
+        }
+        if (client == NULL)
+        {
+            // advertising may still have been on when the last slot was taken, drop the extra link
+            ESP_LOGW(TAG, "No free client slot, disconnecting " ESP_BD_ADDR_STR "", ESP_BD_ADDR_HEX(param->connect.remote_bda));
+            esp_ble_gap_disconnect(param->connect.remote_bda);
+            break;
+        }
+        ESP_LOGI(TAG, "Client connected, conn_id %d, remote " ESP_BD_ADDR_STR "", param->connect.conn_id,
+                 ESP_BD_ADDR_HEX(param->connect.remote_bda));
+        *client = (relay_client_t){.in_use = true, .conn_id = param->connect.conn_id};
+
+        // ask for an interval no longer than the one of the scale, so relaying does not add a full interval
+        esp_ble_conn_update_params_t conn_params = {0};
+        memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        conn_params.min_int = 0x0C; // unit is 1.25 ms
+        conn_params.max_int = 0x18;
+        conn_params.latency = 0;
+        conn_params.timeout = 400; // unit is 10 ms
+        esp_ble_gap_update_conn_params(&conn_params);
+
+        start_advertising();
+        break;
+    }
+    case ESP_GATTS_DISCONNECT_EVT:
+    {
+        relay_client_t *client = find_client(param->disconnect.conn_id);
+        if (client == NULL)
+        {
+            break;
+        }
+        DLOGI(TAG, "Client disconnected, conn_id %d, reason 0x%02x", param->disconnect.conn_id, param->disconnect.reason);
+        client->in_use = false;
+        start_advertising();
+        break;
+    }
+    case ESP_GATTS_WRITE_EVT:
+        handle_write(param);
+        break;
+    case ESP_GATTS_MTU_EVT:
+        DLOGI(TAG, "MTU exchange, conn_id %d, MTU %d", param->mtu.conn_id, param->mtu.mtu);
+        break;
+    default:
+        break;
+    }
+}
+
+// GAP events that belong to advertising, passed on by the GAP handler of the scale connection
+void ble_relay_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    switch (event)
+    {
+    case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
+        adv_configured = true;
+        start_advertising();
+        break;
+    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+        if (param->adv_start_cmpl.status != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Advertising start failed, status %x", param->adv_start_cmpl.status);
+            break;
+        }
+        DLOGI(TAG, "Advertising start successfully");
+        break;
+    default:
+        break;
+    }
+}
+
+// The power profiles stop advertising when the battery runs low, phones already connected stay connected
+void ble_relay_set_advertising(bool allowed)
+{
+    if (allowed == adv_allowed)
+    {
+        return;
+    }
+    adv_allowed = allowed;
+    if (allowed)
+    {
+        start_advertising();
+    }
+    else if (adv_configured)
+    {
+        esp_ble_gap_stop_advertising();
+    }
+}
+
+// Call after Bluedroid is enabled
+void ble_relay_init(void)
+{
+    esp_err_t ret = esp_ble_gatts_register_callback(gatts_event_handler);
+    if (ret)
+    {
+        ESP_LOGE(TAG, "%s gatts register failed, error code = %x", __func__, ret);
+        return;
+    }
+    ret = esp_ble_gatts_app_register(RELAY_APP_ID);
+    if (ret)
+    {
+        ESP_LOGE(TAG, "%s gatts app register failed, error code = %x", __func__, ret);
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_gap_ble_api.h"
+
+void ble_relay_init(void);
+void ble_relay_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+void ble_relay_forward(const uint8_t *data, uint16_t len);
+void ble_relay_weight(int16_t weight10);
+void ble_relay_timer(uint16_t seconds, bool running);
+void ble_relay_set_advertising(bool allowed);
+bool ble_relay_is_relay_adv(const uint8_t *adv, uint16_t adv_len);
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "scale/scale_driver.h"
+
+#if SCALE_DRIVER_ACAIA
+
+// Acaia protocol over the serial service of newer Lunar, Pearl S and Pyxis scales.
+// Messages are EF DD | type | payload | checksum of even bytes | checksum of odd bytes.
+#define ACAIA_HEADER1 0xef
+#define ACAIA_HEADER2 0xdd
+#define ACAIA_MSG_TARE 0x04
+#define ACAIA_MSG_HEARTBEAT 0x00
+#define ACAIA_MSG_IDENTIFY 0x0b
+#define ACAIA_MSG_EVENT 0x0c
+#define ACAIA_MSG_TIMER 0x0d
+#define ACAIA_EVENT_WEIGHT 0x05
+#define ACAIA_EVENT_HEARTBEAT 0x0b
+
+// PROCHBT and LUNAR are older models on the legacy protocol and another service, they are left out
+static const char *const name_prefixes[] = {"ACAIA", "PEARL", "PYXIS", "CINCO", "UMBRA", NULL};
+
+// the scale only sends weights after it was identified and asked for events
+static const scale_cmd_t init_cmds[] = {SCALE_CMD_IDENTIFY, SCALE_CMD_SUBSCRIBE};
+
+// weight, unit (decimal places), sign in bit 1 of the flags
+static bool decode_weight(const uint8_t *p, int16_t *weight10)
+{
+    int32_t value = p[0] | (p[1] << 8) | (p[2] << 16);
+    switch (p[4])
+    {
+    case 0:
+        value *= 10;
+        break;
+    case 1:
+        break;
+    case 2:
+        value /= 10;
+        break;
+    case 3:
+        value /= 100;
+        break;
+    default:
+        return false;
+    }
+    *weight10 = (int16_t)((p[5] & 0x02) ? -value : value);
+    return true;
+}
+
+static bool acaia_decode(const uint8_t *data, uint16_t len, int16_t *weight10)
+{
+    if (len < 5 || data[0] != ACAIA_HEADER1 || data[1] != ACAIA_HEADER2 || data[2] != ACAIA_MSG_EVENT)
+    {
+        return false;
+    }
+    // data[3] is the length of the event
+    const uint8_t *event = &data[5];
+    uint16_t event_len = len - 5;
+    if (data[4] == ACAIA_EVENT_WEIGHT && event_len >= 6)
+    {
+        return decode_weight(event, weight10);
+    }
+    if (data[4] == ACAIA_EVENT_HEARTBEAT && event_len >= 9 && event[2] == ACAIA_EVENT_WEIGHT)
+    {
+        return decode_weight(&event[3], weight10);
+    }
+    return false;
+}
+
+static uint8_t encode(uint8_t type, const uint8_t *payload, uint8_t len, uint8_t *out)
+{
+    uint8_t sum_even = 0;
+    uint8_t sum_odd = 0;
+    out[0] = ACAIA_HEADER1;
+    out[1] = ACAIA_HEADER2;
+    out[2] = type;
+    for (int i = 0; i < len; i++)
+    {
+        out[3 + i] = payload[i];
+        if (i % 2 == 0)
+        {
+            sum_even += payload[i];
+        }
+        else
+        {
+            sum_odd += payload[i];
+        }
+    }
+    out[3 + len] = sum_even;
+    out[4 + len] = sum_odd;
+    return len + 5;
+}
+
+static uint8_t acaia_encode(scale_cmd_t cmd, uint8_t *out)
+{
+    static const uint8_t tare[] = {0x00};
+    static const uint8_t heartbeat[] = {0x02, 0x00};
+    static const uint8_t identify[] = "012345678901234";
+    // length, then pairs of event type and interval: weight, battery, timer, key, setting
+    static const uint8_t subscribe[] = {0x09, 0x00, 0x01, 0x01, 0x02, 0x02, 0x05, 0x03, 0x04};
+    static const uint8_t timer_start[] = {0x00, 0x00};
+    static const uint8_t timer_reset[] = {0x00, 0x01};
+    static const uint8_t timer_stop[] = {0x00, 0x02};
+
+    switch (cmd)
+    {
+    case SCALE_CMD_TARE:
+        return encode(ACAIA_MSG_TARE, tare, sizeof(tare), out);
+    case SCALE_CMD_HEARTBEAT:
+        return encode(ACAIA_MSG_HEARTBEAT, heartbeat, sizeof(heartbeat), out);
+    case SCALE_CMD_IDENTIFY:
+        return encode(ACAIA_MSG_IDENTIFY, identify, sizeof(identify) - 1, out);
+    case SCALE_CMD_SUBSCRIBE:
+        return encode(ACAIA_MSG_EVENT, subscribe, sizeof(subscribe), out);
+    case SCALE_CMD_TIMER_START:
+        return encode(ACAIA_MSG_TIMER, timer_start, sizeof(timer_start), out);
+    case SCALE_CMD_TIMER_STOP:
+        return encode(ACAIA_MSG_TIMER, timer_stop, sizeof(timer_stop), out);
+    case SCALE_CMD_TIMER_RESET:
+        return encode(ACAIA_MSG_TIMER, timer_reset, sizeof(timer_reset), out);
+    default:
+        return 0;
+    }
+}
+
+// UUIDs are stored little endian
+// service 49535343-fe7d-4ae5-8fa9-9fafd205e455
+// write   49535343-8841-43f4-a8d4-ecbe34729bb3
+// notify  49535343-1e4d-4bd9-ba61-23c647249616
+const scale_driver_t scale_driver_acaia = {
+    .name = "acaia",
+    .name_prefixes = name_prefixes,
+    .service_uuid = {.len = ESP_UUID_LEN_128, .uuid = {.uuid128 = {0x55, 0xe4, 0x05, 0xd2, 0xaf, 0x9f, 0xa9, 0x8f, 0xe5, 0x4a, 0x7d, 0xfe, 0x43, 0x53, 0x53, 0x49}}},
+    .notify_char_uuid = {.len = ESP_UUID_LEN_128, .uuid = {.uuid128 = {0x16, 0x96, 0x24, 0x47, 0xc6, 0x23, 0x61, 0xba, 0xd9, 0x4b, 0x4d, 0x1e, 0x43, 0x53, 0x53, 0x49}}},
+    .command_char_uuid = {.len = ESP_UUID_LEN_128, .uuid = {.uuid128 = {0xb3, 0x9b, 0x72, 0x34, 0xbe, 0xec, 0xd4, 0xa8, 0xf4, 0x43, 0x41, 0x88, 0x43, 0x53, 0x53, 0x49}}},
+    .write_type = ESP_GATT_WRITE_TYPE_NO_RSP,
+    .init_cmds = init_cmds,
+    .init_cmd_count = sizeof(init_cmds) / sizeof(init_cmds[0]),
+    .heartbeat_ms = 3000,
+    .sample_ms = 200,
+    .decode = acaia_decode,
+    .encode = acaia_encode,
+};
+
+#endif
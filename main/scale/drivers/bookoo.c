@@ -0,0 +1,70 @@
+#include <string.h>
+#include "scale/scale_driver.h"
+
+#if SCALE_DRIVER_BOOKOO
+
+// Bookoo Themis style scales. Weight packets are 20 bytes:
+// 03 0b | timer ms (3) | unit | weight sign | weight g * 100 (3) | flow sign | flow g/s * 100 (2) | ...
+#define BOOKOO_SERVICE_UUID 0x0FFE
+#define BOOKOO_WEIGHT_CHAR_UUID 0xFF11
+#define BOOKOO_COMMAND_CHAR_UUID 0xFF12
+#define BOOKOO_CMD_LEN 6
+
+static const char *const name_prefixes[] = {"BOOKOO", NULL};
+
+static const scale_cmd_t init_cmds[] = {SCALE_CMD_TARE};
+
+static bool bookoo_decode(const uint8_t *data, uint16_t len, int16_t *weight10)
+{
+    if (len < 10 || data[0] != 0x03 || data[1] != 0x0b)
+    {
+        return false;
+    }
+    int32_t value = (data[7] << 16) | (data[8] << 8) | data[9];
+    value /= 10; // 0.01 g to 0.1 g
+    *weight10 = (int16_t)(data[6] == '-' ? -value : value);
+    return true;
+}
+
+// The frames as Bookoo documents them. The last byte is a checksum that is not a plain XOR of the
+// others, so the frames are sent as they are instead of being computed.
+static const struct
+{
+    scale_cmd_t cmd;
+    uint8_t frame[BOOKOO_CMD_LEN];
+} commands[] = {
+    {SCALE_CMD_TARE, {0x03, 0x0a, 0x01, 0x00, 0x00, 0x08}},
+    {SCALE_CMD_TIMER_START, {0x03, 0x0a, 0x04, 0x00, 0x00, 0x0a}},
+    {SCALE_CMD_TIMER_STOP, {0x03, 0x0a, 0x05, 0x00, 0x00, 0x0d}},
+    {SCALE_CMD_TIMER_RESET, {0x03, 0x0a, 0x06, 0x00, 0x00, 0x0c}},
+};
+
+static uint8_t bookoo_encode(scale_cmd_t cmd, uint8_t *out)
+{
+    for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if (commands[i].cmd == cmd)
+        {
+            memcpy(out, commands[i].frame, BOOKOO_CMD_LEN);
+            return BOOKOO_CMD_LEN;
+        }
+    }
+    return 0;
+}
+
+const scale_driver_t scale_driver_bookoo = {
+    .name = "bookoo",
+    .name_prefixes = name_prefixes,
+    .service_uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = BOOKOO_SERVICE_UUID}},
+    .notify_char_uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = BOOKOO_WEIGHT_CHAR_UUID}},
+    .command_char_uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = BOOKOO_COMMAND_CHAR_UUID}},
+    .write_type = ESP_GATT_WRITE_TYPE_NO_RSP,
+    .init_cmds = init_cmds,
+    .init_cmd_count = sizeof(init_cmds) / sizeof(init_cmds[0]),
+    .heartbeat_ms = 0,
+    .sample_ms = 100,
+    .decode = bookoo_decode,
+    .encode = bookoo_encode,
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "scale/scale_driver.h"
+
+#if SCALE_DRIVER_DECENT
+
+// The UUID of the service containing characteristics: 0000fff0-0000-1000-8000-00805f9b34fb
+// The UUID of the set chatacteristic:                 000036f5-0000-1000-8000-00805f9b34fb
+// The UUID of the notify chatacteristic:              0000fff4-0000-1000-8000-00805f9b34fb
+#define DECENT_SERVICE_UUID 0xFFF0
+#define DECENT_SET_CHAR_UUID 0x36F5
+#define DECENT_NOTIFY_CHAR_UUID 0xFFF4
+#define DECENT_CMD_LEN 7
+
+// Commands are 7 bytes, the last one is the XOR of the others
+static const uint8_t tare[] = {0x03, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x0c};
+static const uint8_t led_on_gram[] = {0x03, 0x0a, 0x01, 0x01, 0x00, 0x00, 0x09};
+static const uint8_t led_on_ounce[] = {0x03, 0x0a, 0x01, 0x01, 0x01, 0x00, 0x08};
+static const uint8_t led_off[] = {0x03, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x09};
+
+static const uint8_t power_off[] = {0x03, 0x0a, 0x02, 0x00, 0x00, 0x00, 0x0b};
+
+static const uint8_t timer_on[] = {0x03, 0x0b, 0x03, 0x00, 0x00, 0x00, 0x0b};
+static const uint8_t timer_off[] = {0x03, 0x0b, 0x00, 0x00, 0x00, 0x00, 0x08};
+static const uint8_t timer_reset[] = {0x03, 0x0b, 0x02, 0x00, 0x00, 0x00, 0x0a};
+
+static const char *const name_prefixes[] = {"Decent Scale", NULL};
+
+// Decent Scale requires to be sent a few commands before it
+// starts delivering weight notifications
+static const scale_cmd_t init_cmds[] = {SCALE_CMD_TARE, SCALE_CMD_LED_ON_GRAM, SCALE_CMD_TARE};
+
+// 03 ce|ca weight_hi weight_lo ..., button presses come as 03 aa ...
+static bool decent_decode(const uint8_t *data, uint16_t len, int16_t *weight10)
+{
+    if (len <= 3 || data[1] == 0xaa)
+    {
+        return false;
+    }
+    *weight10 = (int16_t)((data[2] << 8) + data[3]);
+    return true;
+}
+
+static uint8_t decent_encode(scale_cmd_t cmd, uint8_t *out)
+{
+    const uint8_t *src = NULL;
+    switch (cmd)
+    {
+    case SCALE_CMD_TARE:
+        src = tare;
+        break;
+    case SCALE_CMD_LED_ON_GRAM:
+        src = led_on_gram;
+        break;
+    case SCALE_CMD_LED_ON_OUNCE:
+        src = led_on_ounce;
+        break;
+    case SCALE_CMD_LED_OFF:
+        src = led_off;
+        break;
+    case SCALE_CMD_POWER_OFF:
+        src = power_off;
+        break;
+    case SCALE_CMD_TIMER_START:
+        src = timer_on;
+        break;
+    case SCALE_CMD_TIMER_STOP:
+        src = timer_off;
+        break;
+    case SCALE_CMD_TIMER_RESET:
+        src = timer_reset;
+        break;
+    default:
+        return 0;
+    }
+    memcpy(out, src, DECENT_CMD_LEN);
+    return DECENT_CMD_LEN;
+}
+
+const scale_driver_t scale_driver_decent = {
+    .name = "decent",
+    .name_prefixes = name_prefixes,
+    .service_uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = DECENT_SERVICE_UUID}},
+    .notify_char_uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = DECENT_NOTIFY_CHAR_UUID}},
+    .command_char_uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = DECENT_SET_CHAR_UUID}},
+    .write_type = ESP_GATT_WRITE_TYPE_RSP,
+    .init_cmds = init_cmds,
+    .init_cmd_count = sizeof(init_cmds) / sizeof(init_cmds[0]),
+    .heartbeat_ms = 0,
+    .sample_ms = 100,
+    .decode = decent_decode,
+    .encode = decent_encode,
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string.h>
+#include "nvs.h"
+#include "esp_log.h"
+#include "handle_cache.h"
+
+#define CACHE_NAMESPACE "scale_handles"
+#define CACHE_VERSION 1
+#define CACHE_DRIVER_LEN 8
+
+// One blob per scale, the key is the address in hex
+typedef struct
+{
+    uint8_t version;
+    char driver[CACHE_DRIVER_LEN]; // a scale that now talks a different protocol is discovered again
+    scale_handles_t handles;
+} cache_entry_t;
+
+static const char *TAG = "handle_cache";
+
+static void make_key(const esp_bd_addr_t bda, char *key)
+{
+    snprintf(key, 13, "%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
+
+bool handle_cache_load(const esp_bd_addr_t bda, const char *driver_name, scale_handles_t *handles)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return false;
+    }
+    char key[13];
+    make_key(bda, key);
+    cache_entry_t entry;
+    size_t len = sizeof(entry);
+    esp_err_t ret = nvs_get_blob(nvs, key, &entry, &len);
+    nvs_close(nvs);
+    if (ret != ESP_OK || len != sizeof(entry) || entry.version != CACHE_VERSION ||
+        strncmp(entry.driver, driver_name, CACHE_DRIVER_LEN) != 0)
+    {
+        return false;
+    }
+    *handles = entry.handles;
+    ESP_LOGI(TAG, "Handles of %s loaded, set %d, notify %d, ccc %d", key, handles->set_char, handles->notify_char, handles->ccc);
+    return true;
+}
+
+void handle_cache_store(const esp_bd_addr_t bda, const char *driver_name, const scale_handles_t *handles)
+{
+    cache_entry_t entry = {.version = CACHE_VERSION, .handles = *handles};
+    strncpy(entry.driver, driver_name, CACHE_DRIVER_LEN);
+    char key[13];
+    make_key(bda, key);
+
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "nvs_open failed: %s", esp_err_to_name(ret));
+        return;
+    }
+    ret = nvs_set_blob(nvs, key, &entry, sizeof(entry));
+    if (ret == ESP_OK)
+    {
+        ret = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Storing handles of %s failed: %s", key, esp_err_to_name(ret));
+    }
+}
+
+void handle_cache_erase(const esp_bd_addr_t bda)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    char key[13];
+    make_key(bda, key);
+    if (nvs_erase_key(nvs, key) == ESP_OK)
+    {
+        nvs_commit(nvs);
+        ESP_LOGI(TAG, "Handles of %s dropped", key);
+    }
+    nvs_close(nvs);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_bt_defs.h"
+
+// Attribute handles of one scale, kept in NVS so a reconnect needs no service discovery
+typedef struct
+{
+    uint16_t service_start;
+    uint16_t service_end;
+    uint16_t set_char;
+    uint16_t notify_char;
+    uint16_t ccc;
+} scale_handles_t;
+
+bool handle_cache_load(const esp_bd_addr_t bda, const char *driver_name, scale_handles_t *handles);
+void handle_cache_store(const esp_bd_addr_t bda, const char *driver_name, const scale_handles_t *handles);
+void handle_cache_erase(const esp_bd_addr_t bda);
@@ -0,0 +1,112 @@
+#include <string.h>
+#include "esp_gap_ble_api.h"
+#include "scale_driver.h"
+
+#if !SCALE_DRIVER_DECENT && !SCALE_DRIVER_ACAIA && !SCALE_DRIVER_BOOKOO
+#error "No scale driver selected"
+#endif
+
+static const scale_driver_t *const drivers[] = {
+#if SCALE_DRIVER_DECENT
+    &scale_driver_decent,
+#endif
+#if SCALE_DRIVER_ACAIA
+    &scale_driver_acaia,
+#endif
+#if SCALE_DRIVER_BOOKOO
+    &scale_driver_bookoo,
+#endif
+};
+
+// Runs once per advertisement while scanning, never on the notify path
+const scale_driver_t *scale_driver_detect(const uint8_t *adv_name, uint8_t len)
+{
+    if (adv_name == NULL)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < sizeof(drivers) / sizeof(drivers[0]); i++)
+    {
+        for (const char *const *prefix = drivers[i]->name_prefixes; *prefix != NULL; prefix++)
+        {
+            size_t prefix_len = strlen(*prefix);
+            if (len >= prefix_len && strncmp((const char *)adv_name, *prefix, prefix_len) == 0)
+            {
+                return drivers[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool has_service(const uint8_t *adv, uint16_t adv_len, const esp_bt_uuid_t *uuid)
+{
+    static const uint8_t types16[] = {ESP_BLE_AD_TYPE_16SRV_CMPL, ESP_BLE_AD_TYPE_16SRV_PART};
+    static const uint8_t types128[] = {ESP_BLE_AD_TYPE_128SRV_CMPL, ESP_BLE_AD_TYPE_128SRV_PART};
+    uint8_t len = 0;
+    for (int t = 0; t < 2; t++)
+    {
+        if (uuid->len == ESP_UUID_LEN_16)
+        {
+            const uint8_t *list = esp_ble_resolve_adv_data_by_type((uint8_t *)adv, adv_len, types16[t], &len);
+            for (int i = 0; list != NULL && i + 1 < len; i += 2)
+            {
+                if ((list[i] | (list[i + 1] << 8)) == uuid->uuid.uuid16)
+                {
+                    return true;
+                }
+            }
+        }
+        else if (uuid->len == ESP_UUID_LEN_128)
+        {
+            const uint8_t *list = esp_ble_resolve_adv_data_by_type((uint8_t *)adv, adv_len, types128[t], &len);
+            for (int i = 0; list != NULL && i + ESP_UUID_LEN_128 <= len; i += ESP_UUID_LEN_128)
+            {
+                if (memcmp(&list[i], uuid->uuid.uuid128, ESP_UUID_LEN_128) == 0)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// adv holds the advertisement followed by the scan response. A 128 bit service UUID belongs to the
+// vendor and is enough on its own, it costs no string compares. The 16 bit UUIDs of Decent (0xFFF0)
+// and Bookoo (0x0FFE) are used by plenty of cheap BLE modules, so those scales are found by name as
+// they always were. Relays of other remotes carry the same name, the caller drops them by their marker.
+const scale_driver_t *scale_driver_from_adv(const uint8_t *adv, uint16_t adv_len)
+{
+    for (int i = 0; i < sizeof(drivers) / sizeof(drivers[0]); i++)
+    {
+        if (drivers[i]->service_uuid.len == ESP_UUID_LEN_128 && has_service(adv, adv_len, &drivers[i]->service_uuid))
+        {
+            return drivers[i];
+        }
+    }
+    uint8_t name_len = 0;
+    const uint8_t *name = esp_ble_resolve_adv_data_by_type((uint8_t *)adv, adv_len, ESP_BLE_AD_TYPE_NAME_CMPL, &name_len);
+    if (name == NULL)
+    {
+        name = esp_ble_resolve_adv_data_by_type((uint8_t *)adv, adv_len, ESP_BLE_AD_TYPE_NAME_SHORT, &name_len);
+    }
+    return scale_driver_detect(name, name_len);
+}
+
+bool scale_uuid_equal(const esp_bt_uuid_t *a, const esp_bt_uuid_t *b)
+{
+    if (a->len != b->len)
+    {
+        return false;
+    }
+    switch (a->len)
+    {
+    case ESP_UUID_LEN_16:
+        return a->uuid.uuid16 == b->uuid.uuid16;
+    case ESP_UUID_LEN_32:
+        return a->uuid.uuid32 == b->uuid.uuid32;
+    default:
+        return memcmp(a->uuid.uuid128, b->uuid.uuid128, ESP_UUID_LEN_128) == 0;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_gatt_defs.h"
+
+// Drivers compiled into the firmware, override with -D to leave some out
+#ifndef SCALE_DRIVER_DECENT
+#define SCALE_DRIVER_DECENT 1
+#endif
+#ifndef SCALE_DRIVER_ACAIA
+#define SCALE_DRIVER_ACAIA 1
+#endif
+#ifndef SCALE_DRIVER_BOOKOO
+#define SCALE_DRIVER_BOOKOO 1
+#endif
+
+#define SCALE_CMD_MAX 20 // longest encoded command of all drivers
+
+typedef enum
+{
+    SCALE_CMD_TARE,
+    SCALE_CMD_LED_ON_GRAM,
+    SCALE_CMD_LED_ON_OUNCE,
+    SCALE_CMD_LED_OFF,
+    SCALE_CMD_POWER_OFF,
+    SCALE_CMD_TIMER_START,
+    SCALE_CMD_TIMER_STOP,
+    SCALE_CMD_TIMER_RESET,
+    SCALE_CMD_IDENTIFY,
+    SCALE_CMD_SUBSCRIBE,
+    SCALE_CMD_HEARTBEAT,
+} scale_cmd_t;
+
+// One scale protocol. Drivers are const tables, the notify path calls decode through the
+// driver of the connection without looking anything up.
+typedef struct
+{
+    const char *name;
+    const char *const *name_prefixes; // advertised names, NULL terminated
+    esp_bt_uuid_t service_uuid;
+    esp_bt_uuid_t notify_char_uuid;
+    esp_bt_uuid_t command_char_uuid;
+    esp_gatt_write_type_t write_type;
+    const scale_cmd_t *init_cmds; // sent once notifications are registered
+    uint8_t init_cmd_count;
+    uint16_t heartbeat_ms; // 0 = no keep alive needed
+    uint16_t sample_ms;    // expected time between weight notifications
+
+    // true if the notification carried a weight
+    bool (*decode)(const uint8_t *data, uint16_t len, int16_t *weight10);
+    // encoded length, 0 if the scale does not know the command
+    uint8_t (*encode)(scale_cmd_t cmd, uint8_t *out);
+} scale_driver_t;
+
+#if SCALE_DRIVER_DECENT
+extern const scale_driver_t scale_driver_decent;
+#endif
+#if SCALE_DRIVER_ACAIA
+extern const scale_driver_t scale_driver_acaia;
+#endif
+#if SCALE_DRIVER_BOOKOO
+extern const scale_driver_t scale_driver_bookoo;
+#endif
+
+const scale_driver_t *scale_driver_detect(const uint8_t *adv_name, uint8_t len);
+const scale_driver_t *scale_driver_from_adv(const uint8_t *adv, uint16_t adv_len);
+bool scale_uuid_equal(const esp_bt_uuid_t *a, const esp_bt_uuid_t *b);
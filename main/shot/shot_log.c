@@ -0,0 +1,426 @@
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "shot_log.h"
+
+// Shot recorder.
+//
+// Samples are varint encoded into a RAM buffer straight from the BLE notify path. When the
+// shot ends the buffer is queued to a low priority writer task, which is the only place that
+// erases or programs flash.
+//
+// The shotlog partition is an append-only ring of sectors. A record never crosses a sector
+// boundary, so when the log wraps around, erasing a sector drops whole shots (the oldest ones).
+
+#define SHOT_PARTITION_SUBTYPE 0x40
+#define SHOT_SECTOR_SIZE 4096
+#define SHOT_RECORD_MAX SHOT_SECTOR_SIZE
+#define SHOT_PAYLOAD_MAX (SHOT_RECORD_MAX - sizeof(shot_header_t))
+#define SHOT_SAMPLE_MAX_BYTES 6 // 3 byte varint for the time step plus 3 for the weight change
+#define SHOT_ALIGN(len) (((len) + 3) & ~3)
+#define SHOT_MAX_PER_SECTOR (SHOT_SECTOR_SIZE / (sizeof(shot_header_t) + 2))
+#define SHOT_READ_CHUNK 128
+
+typedef struct
+{
+    uint8_t data[SHOT_RECORD_MAX]; // header followed by payload
+    uint16_t len;                  // payload bytes
+    volatile bool busy;            // queued for the writer
+} shot_buffer_t;
+
+static const char *TAG = "shot_log";
+
+static shot_buffer_t buffers[2];
+static int next_buffer = 0;
+static shot_buffer_t *volatile recording = NULL;
+static portMUX_TYPE shot_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// state of the shot being recorded, guarded by shot_mux
+static int64_t start_us;
+static int64_t last_us;
+static int16_t last_weight10;
+static int32_t flow10;
+static uint16_t peak_flow10;
+static uint16_t sample_count;
+static int16_t target_weight10 = 0;
+
+// writer state, only touched by the writer task
+static QueueHandle_t write_queue = NULL;
+static const esp_partition_t *partition = NULL;
+static uint32_t write_offset = 0;
+static uint32_t next_seq = 1;
+static volatile bool log_ready = false;
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static inline uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+// Target yield of the next shots, 0 = no target
+void shot_log_set_target(int16_t weight10)
+{
+    taskENTER_CRITICAL(&shot_mux);
+    target_weight10 = weight10;
+    taskEXIT_CRITICAL(&shot_mux);
+}
+
+void shot_log_begin(void)
+{
+    shot_buffer_t *b = &buffers[next_buffer];
+    if (b->busy)
+    {
+        ESP_LOGW(TAG, "Previous shot still being written, not recording");
+        return;
+    }
+    next_buffer = (next_buffer + 1) % 2;
+
+    taskENTER_CRITICAL(&shot_mux);
+    b->len = 0;
+    start_us = esp_timer_get_time();
+    last_us = start_us;
+    last_weight10 = 0;
+    flow10 = 0;
+    peak_flow10 = 0;
+    sample_count = 0;
+    recording = b;
+    taskEXIT_CRITICAL(&shot_mux);
+}
+
+// Called for every weight notification, keep it short
+void shot_log_sample(int16_t weight10)
+{
+    if (recording == NULL)
+    {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&shot_mux);
+    shot_buffer_t *b = recording;
+    if (b != NULL && b->len + SHOT_SAMPLE_MAX_BYTES <= SHOT_PAYLOAD_MAX)
+    {
+        uint32_t dt_ms = (uint32_t)((now - last_us) / 1000);
+        int32_t delta = weight10 - last_weight10; // the first sample is relative to 0
+        uint8_t *p = &b->data[sizeof(shot_header_t) + b->len];
+        p = put_varint(p, dt_ms);
+        p = put_varint(p, zigzag(delta));
+        b->len = p - &b->data[sizeof(shot_header_t)];
+
+        if (sample_count > 0 && dt_ms > 0)
+        {
+            // flow in 0.1 g/s, smoothed over roughly four samples
+            flow10 += ((delta * 1000 / (int32_t)dt_ms) - flow10) / 4;
+            if (flow10 > peak_flow10)
+            {
+                peak_flow10 = flow10;
+            }
+        }
+        last_us = now;
+        last_weight10 = weight10;
+        sample_count++;
+    }
+    taskEXIT_CRITICAL(&shot_mux);
+}
+
+// Current flow of the shot being recorded in 0.1 g/s, 0 while not recording
+int16_t shot_log_flow10(void)
+{
+    int16_t flow = 0;
+    taskENTER_CRITICAL(&shot_mux);
+    if (recording != NULL)
+    {
+        flow = (int16_t)flow10;
+    }
+    taskEXIT_CRITICAL(&shot_mux);
+    return flow;
+}
+
+void shot_log_end(void)
+{
+    // there is no SNTP and no RTC chip, so this counts from power-on, see shot_header_t
+    uint32_t now = (uint32_t)time(NULL);
+    uint16_t count = 0;
+
+    taskENTER_CRITICAL(&shot_mux);
+    shot_buffer_t *b = recording;
+    recording = NULL;
+    if (b != NULL)
+    {
+        shot_header_t *hdr = (shot_header_t *)b->data;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->magic = SHOT_MAGIC;
+        hdr->payload_len = b->len;
+        hdr->duration_ds = (uint16_t)((esp_timer_get_time() - start_us) / 100000);
+        hdr->start_time = now - hdr->duration_ds / 10;
+        hdr->target_weight10 = target_weight10;
+        hdr->final_weight10 = last_weight10;
+        hdr->peak_flow10 = peak_flow10;
+        hdr->sample_count = sample_count;
+        count = sample_count;
+    }
+    taskEXIT_CRITICAL(&shot_mux);
+
+    if (b == NULL || count == 0 || write_queue == NULL)
+    {
+        return;
+    }
+    b->busy = true;
+    if (xQueueSend(write_queue, &b, 0) != pdTRUE)
+    {
+        b->busy = false;
+        ESP_LOGW(TAG, "Write queue full, shot dropped");
+    }
+}
+
+static bool read_header(uint32_t offset, shot_header_t *hdr)
+{
+    if (esp_partition_read(partition, offset, hdr, sizeof(*hdr)) != ESP_OK)
+    {
+        return false;
+    }
+    return hdr->magic == SHOT_MAGIC && hdr->payload_len <= SHOT_PAYLOAD_MAX;
+}
+
+// Find the sector holding the newest shot and the first free byte behind it
+static void find_log_head(void)
+{
+    shot_header_t hdr;
+    uint32_t head_sector = 0;
+    uint32_t newest_seq = 0;
+    uint32_t sectors = partition->size / SHOT_SECTOR_SIZE;
+
+    for (uint32_t s = 0; s < sectors; s++)
+    {
+        if (read_header(s * SHOT_SECTOR_SIZE, &hdr) && hdr.seq >= newest_seq)
+        {
+            newest_seq = hdr.seq;
+            head_sector = s;
+        }
+    }
+    if (newest_seq == 0)
+    {
+        ESP_LOGI(TAG, "Shot log is empty");
+        write_offset = 0;
+        next_seq = 1;
+        return;
+    }
+
+    uint32_t offset = head_sector * SHOT_SECTOR_SIZE;
+    uint32_t sector_end = offset + SHOT_SECTOR_SIZE;
+    while (offset + sizeof(hdr) <= sector_end && read_header(offset, &hdr))
+    {
+        if (hdr.seq >= newest_seq)
+        {
+            newest_seq = hdr.seq;
+        }
+        offset += SHOT_ALIGN(sizeof(hdr) + hdr.payload_len);
+    }
+    write_offset = offset % partition->size;
+    next_seq = newest_seq + 1;
+    ESP_LOGI(TAG, "Shot log head at 0x%lx, next shot #%lu", write_offset, next_seq);
+}
+
+static void write_record(shot_buffer_t *b)
+{
+    shot_header_t *hdr = (shot_header_t *)b->data;
+    uint32_t record_len = SHOT_ALIGN(sizeof(*hdr) + b->len);
+    memset(&b->data[sizeof(*hdr) + b->len], 0xff, record_len - sizeof(*hdr) - b->len);
+
+    hdr->seq = next_seq;
+    hdr->crc = 0;
+    hdr->crc = esp_rom_crc32_le(0, b->data, sizeof(*hdr) + b->len);
+
+    // records never cross a sector boundary
+    uint32_t used_in_sector = write_offset % SHOT_SECTOR_SIZE;
+    if (used_in_sector != 0 && used_in_sector + record_len > SHOT_SECTOR_SIZE)
+    {
+        write_offset = (write_offset - used_in_sector + SHOT_SECTOR_SIZE) % partition->size;
+    }
+    if (write_offset % SHOT_SECTOR_SIZE == 0)
+    {
+        esp_err_t ret = esp_partition_erase_range(partition, write_offset, SHOT_SECTOR_SIZE);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Erase at 0x%lx failed: %s", write_offset, esp_err_to_name(ret));
+            return;
+        }
+    }
+    esp_err_t ret = esp_partition_write(partition, write_offset, b->data, record_len);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Write at 0x%lx failed: %s", write_offset, esp_err_to_name(ret));
+        return;
+    }
+    ESP_LOGI(TAG, "Shot #%lu saved: %u samples, %lu bytes, %.1f s", next_seq, hdr->sample_count, record_len, hdr->duration_ds / 10.0f);
+    next_seq++;
+    write_offset = (write_offset + record_len) % partition->size;
+}
+
+static void shot_writer_task(void *params)
+{
+    find_log_head();
+    log_ready = true;
+
+    shot_buffer_t *b;
+    while (1)
+    {
+        if (xQueueReceive(write_queue, &b, portMAX_DELAY) == pdTRUE)
+        {
+            write_record(b);
+            b->busy = false;
+        }
+    }
+}
+
+void shot_log_init(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SHOT_PARTITION_SUBTYPE, "shotlog");
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG, "No shotlog partition, shots are not recorded");
+        return;
+    }
+    write_queue = xQueueCreate(2, sizeof(shot_buffer_t *));
+    xTaskCreatePinnedToCore(shot_writer_task, "shot_writer_task", 1024 * 3, NULL, 2, NULL, 1);
+}
+
+/**
+ * Read up to max shot headers, newest first, after skipping the newest skip shots.
+ * Walks the sectors backwards from the log head, so only headers are read and no
+ * index of all shots has to be kept in RAM.
+ */
+int shot_log_read_page(int skip, shot_entry_t *entries, int max)
+{
+    if (!log_ready)
+    {
+        return 0;
+    }
+    uint32_t head = write_offset;
+    uint32_t sectors = partition->size / SHOT_SECTOR_SIZE;
+    uint32_t sector = (head == 0 ? partition->size - 1 : head - 1) / SHOT_SECTOR_SIZE;
+    uint16_t offsets[SHOT_MAX_PER_SECTOR];
+    shot_header_t hdr;
+    int found = 0;
+
+    for (uint32_t n = 0; n < sectors && found < max; n++)
+    {
+        // collect the records of this sector, they can only be walked forwards
+        uint32_t base = sector * SHOT_SECTOR_SIZE;
+        uint32_t offset = 0;
+        int count = 0;
+        while (offset + sizeof(hdr) <= SHOT_SECTOR_SIZE && count < SHOT_MAX_PER_SECTOR && read_header(base + offset, &hdr))
+        {
+            offsets[count++] = offset;
+            offset += SHOT_ALIGN(sizeof(hdr) + hdr.payload_len);
+        }
+        if (count == 0)
+        {
+            break; // reached erased flash, there are no older shots
+        }
+        for (int i = count - 1; i >= 0 && found < max; i--)
+        {
+            if (skip > 0)
+            {
+                skip--;
+                continue;
+            }
+            entries[found].offset = base + offsets[i];
+            read_header(entries[found].offset, &entries[found].hdr);
+            found++;
+        }
+        sector = (sector == 0 ? sectors : sector) - 1;
+    }
+    return found;
+}
+
+/**
+ * Decode a shot into max_points weights evenly spread over its duration. The payload is
+ * streamed from flash in small chunks and checked against the record CRC.
+ * Returns the number of points, or -1 if the record is corrupt.
+ */
+int shot_log_decode_curve(const shot_entry_t *entry, int16_t *points, int max_points)
+{
+    const shot_header_t *hdr = &entry->hdr;
+    uint32_t duration_ms = hdr->duration_ds * 100;
+    int n_points = hdr->sample_count < max_points ? hdr->sample_count : max_points;
+    if (n_points == 0 || duration_ms == 0)
+    {
+        return 0;
+    }
+
+    shot_header_t crc_hdr = *hdr;
+    crc_hdr.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&crc_hdr, sizeof(crc_hdr));
+
+    uint8_t chunk[SHOT_READ_CHUNK];
+    uint32_t value = 0;
+    int shift = 0;
+    bool is_weight = false;
+    uint32_t t_ms = 0;
+    int16_t weight10 = 0;
+    int point = 0;
+
+    for (uint32_t pos = 0; pos < hdr->payload_len; pos += sizeof(chunk))
+    {
+        uint32_t len = hdr->payload_len - pos < sizeof(chunk) ? hdr->payload_len - pos : sizeof(chunk);
+        if (esp_partition_read(partition, entry->offset + sizeof(*hdr) + pos, chunk, len) != ESP_OK)
+        {
+            return -1;
+        }
+        crc = esp_rom_crc32_le(crc, chunk, len);
+
+        for (uint32_t i = 0; i < len; i++)
+        {
+            value |= (uint32_t)(chunk[i] & 0x7f) << shift;
+            shift += 7;
+            if (chunk[i] & 0x80)
+            {
+                continue;
+            }
+            if (!is_weight)
+            {
+                t_ms += value;
+            }
+            else
+            {
+                weight10 += (int16_t)((value >> 1) ^ -(int32_t)(value & 1));
+                // fill every point up to the time of this sample with the latest weight
+                int target = (uint64_t)t_ms * n_points / duration_ms;
+                while (point <= target && point < n_points)
+                {
+                    points[point++] = weight10;
+                }
+            }
+            is_weight = !is_weight;
+            value = 0;
+            shift = 0;
+        }
+    }
+    if (crc != hdr->crc)
+    {
+        ESP_LOGW(TAG, "Shot #%lu is corrupt", hdr->seq);
+        return -1;
+    }
+    while (point < n_points)
+    {
+        points[point++] = weight10;
+    }
+    return n_points;
+}
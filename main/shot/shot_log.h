@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+#define SHOT_MAGIC 0x5453 // "ST"
+#define SHOT_TARGET_RATIO10 20 // 1:2.0, the usual espresso brew ratio
+
+// Header of one shot record in the shotlog partition, followed by payload_len bytes of samples.
+// Samples are stored as pairs of varints: milliseconds since the previous sample and the
+// zigzag encoded weight change in 0.1 g. The first sample holds the absolute weight.
+typedef struct __attribute__((packed))
+{
+    uint16_t magic;
+    uint16_t payload_len;
+    uint32_t seq;           // increments with every shot, survives wrap-around of the log
+    uint32_t start_time;    // seconds since power-on, runs on through deep sleep; not wall time, use seq for order
+    uint16_t duration_ds;   // 0.1 s
+    int16_t target_weight10; // yield the dose asks for at SHOT_TARGET_RATIO10, 0 = no dose scale
+    int16_t final_weight10;
+    uint16_t peak_flow10;   // 0.1 g/s
+    uint16_t sample_count;
+    uint16_t reserved;
+    uint32_t crc;           // CRC32 of header (with crc = 0) and payload
+} shot_header_t;
+
+// A shot header together with its location in the partition
+typedef struct
+{
+    shot_header_t hdr;
+    uint32_t offset;
+} shot_entry_t;
+
+void shot_log_init(void);
+void shot_log_set_target(int16_t target_weight10);
+void shot_log_begin(void);
+void shot_log_sample(int16_t weight10);
+void shot_log_end(void);
+int16_t shot_log_flow10(void);
+int shot_log_read_page(int skip, shot_entry_t *entries, int max);
+int shot_log_decode_curve(const shot_entry_t *entry, int16_t *points, int max_points);
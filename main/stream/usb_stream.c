@@ -0,0 +1,200 @@
+#include <string.h>
+#include "driver/usb_serial_jtag.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "diag/console.h"
+#include "usb_stream.h"
+
+// Binary streaming of samples and events over the native USB-Serial-JTAG port.
+//
+// Producers only put a fixed size record into a queue, the stream task packs the records into
+// frames and hands them to the USB driver in batches. Frames look like
+//
+//   0xA5 0x5A | type | len | seq | payload[len] | crc8
+//
+// The log output shares the port, so the host decoder resynchronizes on the start bytes and
+// drops frames with a bad CRC.
+//
+// Lines the host sends are console commands, see diag/console.c. Streaming is switched with
+// "stream on" and "stream off", or "S1" and "S0" as tools/stream_decode.py sends them.
+
+#define STREAM_SOF0 0xA5
+#define STREAM_SOF1 0x5A
+#define STREAM_MAX_PAYLOAD 8
+#define STREAM_FRAME_OVERHEAD 6
+#define STREAM_QUEUE_LEN 64
+#define STREAM_TX_BATCH 512
+#define STREAM_FLUSH_MS 20
+#define STREAM_LINE_MAX 64
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t len;
+    uint8_t payload[STREAM_MAX_PAYLOAD];
+} stream_record_t;
+
+static const char *TAG = "usb_stream";
+
+static QueueHandle_t stream_queue = NULL;
+static volatile bool enabled = false;
+static uint8_t tx_buf[STREAM_TX_BATCH];
+static uint8_t seq = 0;
+
+// CRC-8, polynomial 0x07, initial value 0
+static uint8_t crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void push(stream_record_t *r)
+{
+    // never block the producer, a full queue means the host does not keep up
+    xQueueSend(stream_queue, r, 0);
+}
+
+void usb_stream_weight(int16_t weight10)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    stream_record_t r = {.type = STREAM_WEIGHT, .len = 6};
+    put_u32(r.payload, (uint32_t)esp_timer_get_time());
+    put_u16(r.payload + 4, (uint16_t)weight10);
+    push(&r);
+}
+
+void usb_stream_timer(stream_timer_event_t event, uint16_t seconds)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    stream_record_t r = {.type = STREAM_TIMER, .len = 7};
+    put_u32(r.payload, (uint32_t)esp_timer_get_time());
+    r.payload[4] = event;
+    put_u16(r.payload + 5, seconds);
+    push(&r);
+}
+
+void usb_stream_battery(uint16_t millivolts, uint8_t percent)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    stream_record_t r = {.type = STREAM_BATTERY, .len = 7};
+    put_u32(r.payload, (uint32_t)esp_timer_get_time());
+    put_u16(r.payload + 4, millivolts);
+    r.payload[6] = percent;
+    push(&r);
+}
+
+static size_t append_frame(size_t pos, const stream_record_t *r)
+{
+    uint8_t *f = &tx_buf[pos];
+    f[0] = STREAM_SOF0;
+    f[1] = STREAM_SOF1;
+    f[2] = r->type;
+    f[3] = r->len;
+    f[4] = seq++;
+    memcpy(&f[5], r->payload, r->len);
+    f[5 + r->len] = crc8(&f[2], 3 + r->len);
+    return pos + STREAM_FRAME_OVERHEAD + r->len;
+}
+
+// Collects what the host types into lines and hands them to the console
+static void read_host_lines(void)
+{
+    static char line[STREAM_LINE_MAX];
+    static int line_len = 0;
+    uint8_t c;
+    while (usb_serial_jtag_read_bytes(&c, 1, 0) == 1)
+    {
+        if (c == '\r')
+        {
+            continue;
+        }
+        if (c != '\n')
+        {
+            if (line_len < sizeof(line) - 1)
+            {
+                line[line_len++] = c;
+            }
+            continue;
+        }
+        line[line_len] = '\0';
+        console_run_line(line);
+        line_len = 0;
+    }
+}
+
+static void usb_stream_task(void *params)
+{
+    stream_record_t r;
+    while (1)
+    {
+        read_host_lines();
+        if (xQueueReceive(stream_queue, &r, pdMS_TO_TICKS(STREAM_FLUSH_MS)) != pdTRUE)
+        {
+            continue;
+        }
+        // batch everything that is already waiting into one driver write
+        size_t pos = append_frame(0, &r);
+        while (pos + STREAM_FRAME_OVERHEAD + STREAM_MAX_PAYLOAD <= sizeof(tx_buf) && xQueueReceive(stream_queue, &r, 0) == pdTRUE)
+        {
+            pos = append_frame(pos, &r);
+        }
+        usb_serial_jtag_write_bytes(tx_buf, pos, pdMS_TO_TICKS(STREAM_FLUSH_MS));
+    }
+}
+
+void usb_stream_set_enabled(bool on)
+{
+    ESP_LOGI(TAG, "Streaming %s", on ? "on" : "off");
+    enabled = on;
+}
+
+bool usb_stream_enabled(void)
+{
+    return enabled;
+}
+
+void usb_stream_init(void)
+{
+    if (!usb_serial_jtag_is_driver_installed())
+    {
+        usb_serial_jtag_driver_config_t cfg = USB_SERIAL_JTAG_DRIVER_CONFIG_DEFAULT();
+        cfg.tx_buffer_size = 4096;
+        ESP_ERROR_CHECK(usb_serial_jtag_driver_install(&cfg));
+    }
+    stream_queue = xQueueCreate(STREAM_QUEUE_LEN, sizeof(stream_record_t));
+    xTaskCreatePinnedToCore(usb_stream_task, "usb_stream_task", 1024 * 4, NULL, 3, NULL, 1);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Record types of the binary stream, see tools/stream_decode.py for the host side
+typedef enum
+{
+    STREAM_WEIGHT = 0x01,  // t_us u32, weight10 i16
+    STREAM_TIMER = 0x02,   // t_us u32, event u8, seconds u16
+    STREAM_BATTERY = 0x03, // t_us u32, millivolts u16, percent u8
+} stream_type_t;
+
+typedef enum
+{
+    STREAM_TIMER_START = 0,
+    STREAM_TIMER_STOP = 1,
+    STREAM_TIMER_RESET = 2,
+} stream_timer_event_t;
+
+void usb_stream_init(void);
+void usb_stream_set_enabled(bool enabled);
+bool usb_stream_enabled(void);
+void usb_stream_weight(int16_t weight10);
+void usb_stream_timer(stream_timer_event_t event, uint16_t seconds);
+void usb_stream_battery(uint16_t millivolts, uint8_t percent);
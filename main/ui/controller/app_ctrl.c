@@ -0,0 +1,188 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "scale/ble.h"
+#include "power/power_profile.h"
+#include "diag/diagnostics.h"
+#include "diag/console.h"
+#include "ui/view01.h"
+#include "ui/view_diag.h"
+#include "scale_ctrl.h"
+#include "timer_ctrl.h"
+#include "battery_ctrl.h"
+#include "app_ctrl.h"
+
+// One task runs all controller work. It sleeps on an event group until a BLE notification or
+// one of the esp_timers below has something to do:
+// - stale: one shot, armed by every weight for the time the next sample is due, fires once the
+//   scale went quiet
+// - second: only runs while the shot timer runs or the diagnostics screen is shown
+// - battery: every 10 s, battery measurement and the diagnostics log
+// Timer button presses are queued in timer_ctrl and only signalled here, console tunables wait in
+// console.c the same way.
+
+// battery_check and diag_log format floats, newlib printf needs about 2 KB of that alone
+#define CTRL_STACK_SIZE (1024 * 6)
+#define CTRL_PRIORITY 5
+#define CTRL_BATTERY_PERIOD_MS 10000
+
+static const char *TAG = "app_ctrl";
+
+static StaticTask_t ctrl_task_buf;
+static StackType_t ctrl_stack[CTRL_STACK_SIZE];
+static StaticEventGroup_t ctrl_events_buf;
+static EventGroupHandle_t ctrl_events = NULL;
+
+static esp_timer_handle_t stale_timer = NULL;
+static esp_timer_handle_t second_timer = NULL;
+static esp_timer_handle_t battery_timer = NULL;
+
+void app_ctrl_post(uint32_t events)
+{
+    if (ctrl_events != NULL)
+    {
+        xEventGroupSetBits(ctrl_events, events);
+    }
+}
+
+static void timer_cb(void *arg)
+{
+    app_ctrl_post((uint32_t)arg);
+}
+
+static void weight_listener(scale_id_t id)
+{
+    app_ctrl_post(CTRL_EVT_WEIGHT);
+}
+
+// Starts the one second tick unless it is running already, it stops itself when nobody needs it
+void app_ctrl_need_seconds(void)
+{
+    if (second_timer != NULL && !esp_timer_is_active(second_timer))
+    {
+        esp_timer_start_periodic(second_timer, 1000 * 1000);
+    }
+}
+
+// Fires the stale event right when the cup weight turns stale
+static void arm_stale_timer(void)
+{
+    int64_t stale_at = scale_stale_at_us(SCALE_CUP);
+    esp_timer_stop(stale_timer);
+    if (stale_at != 0)
+    {
+        int64_t wait_us = stale_at - esp_timer_get_time();
+        esp_timer_start_once(stale_timer, wait_us > 0 ? wait_us : 1);
+    }
+}
+
+static void on_weight(void)
+{
+    if (!update_weight_stale())
+    {
+        arm_stale_timer();
+    }
+    if (is_on())
+    {
+        show_weight();
+    }
+}
+
+static void on_stale(void)
+{
+    // a sample may have come in since the timer was armed
+    if (!update_weight_stale())
+    {
+        arm_stale_timer();
+    }
+}
+
+static void on_second(void)
+{
+    bool timer_running = get_timer_state() == RUNNING;
+    if (timer_running)
+    {
+        timer_tick();
+    }
+    if (view_diag_active())
+    {
+        diag_update(false);
+    }
+    else if (!timer_running)
+    {
+        esp_timer_stop(second_timer);
+    }
+}
+
+static void on_battery(void)
+{
+    battery_check();
+    diag_update(power_profile_background_allowed());
+}
+
+static void ctrl_task(void *params)
+{
+    while (1)
+    {
+        EventBits_t events = xEventGroupWaitBits(ctrl_events, CTRL_EVT_ALL, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (events & CTRL_EVT_WEIGHT)
+        {
+            on_weight();
+        }
+        if (events & CTRL_EVT_TIMER)
+        {
+            timer_process();
+        }
+        if (events & CTRL_EVT_STALE)
+        {
+            on_stale();
+        }
+        if (events & CTRL_EVT_SECOND)
+        {
+            on_second();
+        }
+        if (events & CTRL_EVT_BATTERY)
+        {
+            on_battery();
+        }
+        if (events & CTRL_EVT_DIAG)
+        {
+            diag_update(true);
+        }
+        if (events & CTRL_EVT_TUNE)
+        {
+            console_apply_tunables();
+        }
+    }
+}
+
+static esp_timer_handle_t make_timer(const char *name, uint32_t event)
+{
+    const esp_timer_create_args_t args = {
+        .callback = timer_cb,
+        .arg = (void *)event,
+        .name = name,
+    };
+    esp_timer_handle_t timer;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+    return timer;
+}
+
+void app_ctrl_start(void)
+{
+    ctrl_events = xEventGroupCreateStatic(&ctrl_events_buf);
+    timer_init();
+    stale_timer = make_timer("ctrl_stale", CTRL_EVT_STALE);
+    second_timer = make_timer("ctrl_second", CTRL_EVT_SECOND);
+    battery_timer = make_timer("ctrl_battery", CTRL_EVT_BATTERY);
+
+    xTaskCreateStaticPinnedToCore(ctrl_task, "ctrl_task", CTRL_STACK_SIZE, NULL, CTRL_PRIORITY, ctrl_stack, &ctrl_task_buf, 1);
+    scale_set_weight_listener(weight_listener);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(battery_timer, CTRL_BATTERY_PERIOD_MS * 1000));
+
+    // first battery reading and the initial dimmed weight right away
+    app_ctrl_post(CTRL_EVT_WEIGHT | CTRL_EVT_BATTERY);
+    ESP_LOGI(TAG, "Controller started");
+}
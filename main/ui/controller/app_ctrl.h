@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+// Work for the controller task, posted as event group bits so repeated posts coalesce
+#define CTRL_EVT_WEIGHT (1 << 0)  // a scale delivered a weight, or switching on or off changed what is shown
+#define CTRL_EVT_STALE (1 << 1)   // no weight for a while
+#define CTRL_EVT_SECOND (1 << 2)  // shot timer and diagnostics screen
+#define CTRL_EVT_BATTERY (1 << 3) // battery and diagnostics log
+#define CTRL_EVT_TIMER (1 << 4)   // timer button pressed
+#define CTRL_EVT_DIAG (1 << 5)    // diagnostics log requested from the console
+#define CTRL_EVT_TUNE (1 << 6)    // brightness, refresh or interval changed from the console
+#define CTRL_EVT_ALL (CTRL_EVT_WEIGHT | CTRL_EVT_STALE | CTRL_EVT_SECOND | CTRL_EVT_BATTERY | CTRL_EVT_TIMER | CTRL_EVT_DIAG | CTRL_EVT_TUNE)
+
+void app_ctrl_start(void);
+void app_ctrl_post(uint32_t events);
+void app_ctrl_need_seconds(void);
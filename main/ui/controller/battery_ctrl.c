@@ -1,22 +1,49 @@
-#include <math.h>
-#include "esp_adc/adc_oneshot.h"
+#include <string.h>
+#include "esp_adc/adc_continuous.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "ui/view01.h"
+#include "power/battery_soc.h"
+#include "power/power_profile.h"
+#include "stream/usb_stream.h"
+#include "battery_ctrl.h"
 
-#define BATTERY_ADC_SIZE 15
 #define EXAMPLE_BATTERY_ADC_CHANNEL ADC_CHANNEL_4
 #define EXAMPLE_ADC_ATTEN ADC_ATTEN_DB_12
 
+// The battery is measured through a 1:3 voltage divider
+#define BATTERY_DIVIDER_FACTOR 3.0f
+
+// Burst configuration: 64 conversions at 20 kHz take 3.2 ms. That spans 32 periods
+// of the 10 kHz backlight PWM, so the median is not biased by the PWM phase.
+#define BATTERY_BURST_SAMPLES 64
+#define BATTERY_SAMPLE_FREQ_HZ (20 * 1000)
+#define BATTERY_FRAME_SIZE (BATTERY_BURST_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES)
+#define BATTERY_BURST_TIMEOUT_MS 50
+
+// IIR smoothing factor for consecutive bursts (new = old + alpha * (burst - old))
+#define BATTERY_IIR_ALPHA 0.25f
+
+// Used when the calibration eFuse is not burnt: nominal full scale at 12 dB attenuation
+#define BATTERY_ADC_RAW_FULL_SCALE_MV 3100
+#define BATTERY_ADC_RAW_MAX ((1 << SOC_ADC_DIGI_MAX_BITWIDTH) - 1)
+
 static const char *TAG = "battery_ctrl";
 
-adc_oneshot_unit_handle_t adc1_handle;
-adc_cali_handle_t adc1_cali_chan0_handle = NULL;
-bool do_calibration1_chan0;
+static adc_continuous_handle_t adc1_handle = NULL;
+static adc_cali_handle_t adc1_cali_chan0_handle = NULL;
+static bool do_calibration1_chan0;
+static TaskHandle_t burst_waiter = NULL;
+static uint8_t burst_buf[BATTERY_FRAME_SIZE];
 
-// static SemaphoreHandle_t battery_mutex = NULL; // not used because there is no state in this controller
+// filtered state, only touched by the battery task
+static float filtered_voltage = 0.0f;
+static uint16_t last_adc_median = 0;
+static bool have_voltage = false;
 
 static bool example_adc_calibration_init(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle)
 {
@@ -76,126 +103,168 @@ static bool example_adc_calibration_init(adc_unit_t unit, adc_channel_t channel,
     return calibrated;
 }
 
+static bool IRAM_ATTR battery_conv_done_cb(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    BaseType_t must_yield = pdFALSE;
+    if (burst_waiter != NULL)
+    {
+        vTaskNotifyGiveFromISR(burst_waiter, &must_yield);
+    }
+    return must_yield == pdTRUE;
+}
+
 void battery_init(void)
 {
-    // As long as there is not state in this controller no need for mutex (hopefully)
-    // if (battery_mutex == NULL)
-    // {
-    //     battery_mutex = xSemaphoreCreateMutex();
-    // }
-
-    adc_oneshot_unit_init_cfg_t init_config1 = {
-        .unit_id = ADC_UNIT_1,
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = BATTERY_FRAME_SIZE * 2,
+        .conv_frame_size = BATTERY_FRAME_SIZE,
     };
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adc1_handle));
+
     //-------------ADC1 Config---------------//
-    adc_oneshot_chan_cfg_t config = {
-        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    adc_digi_pattern_config_t pattern = {
         .atten = EXAMPLE_ADC_ATTEN,
+        .channel = EXAMPLE_BATTERY_ADC_CHANNEL & 0x7,
+        .unit = ADC_UNIT_1,
+        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+    };
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = BATTERY_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
     };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, EXAMPLE_BATTERY_ADC_CHANNEL, &config));
+    ESP_ERROR_CHECK(adc_continuous_config(adc1_handle, &dig_cfg));
+
+    adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = battery_conv_done_cb,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc1_handle, &cbs, NULL));
 
     //-------------ADC1 Calibration Init---------------//
 
     do_calibration1_chan0 = example_adc_calibration_init(ADC_UNIT_1, EXAMPLE_BATTERY_ADC_CHANNEL, EXAMPLE_ADC_ATTEN, &adc1_cali_chan0_handle);
+
+    battery_soc_init();
 }
 
-// 4.2V = 100%
-// 4.0V ≈ 85%
-// 3.8V ≈ 65%
-// 3.6V ≈ 40%
-// 3.4V ≈ 20%
-// 3.2V ≈ 5%
-// 3.0V = 0%
-uint8_t mapBatVolt2Pct(float v)
+static int raw_to_millivolts(int adc_raw)
 {
-    if (v >= 4.2)
+    int voltage_mv;
+    if (do_calibration1_chan0 && adc_cali_raw_to_voltage(adc1_cali_chan0_handle, adc_raw, &voltage_mv) == ESP_OK)
     {
-        return 100;
+        return voltage_mv;
     }
-    if (v >= 4.0 && v < 4.2)
+    // No calibration available: plain linear conversion
+    return (adc_raw * BATTERY_ADC_RAW_FULL_SCALE_MV) / BATTERY_ADC_RAW_MAX;
+}
+
+// Insertion sort is plenty for 64 samples and needs no extra memory
+static uint16_t median(uint16_t *values, int count)
+{
+    for (int i = 1; i < count; i++)
     {
-        return 85;
+        uint16_t v = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > v)
+        {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = v;
     }
-    if (v > 3.8 && v < 4.0)
+    return values[count / 2];
+}
+
+/**
+ * Sample one burst via DMA and fold it into the filtered voltage.
+ * The calling task sleeps until the DMA frame is complete, the CPU does not poll the ADC.
+ */
+esp_err_t battery_measure(void)
+{
+    uint16_t samples[BATTERY_BURST_SAMPLES];
+    int sample_count = 0;
+    uint32_t ret_num = 0;
+
+    burst_waiter = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0); // drop stale notifications
+    esp_err_t ret = adc_continuous_start(adc1_handle);
+    if (ret != ESP_OK)
     {
-        return 65;
+        burst_waiter = NULL;
+        return ret;
     }
-    if (v >= 3.6 && v < 3.8)
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BATTERY_BURST_TIMEOUT_MS)) == 0)
     {
-        return 40;
+        ret = ESP_ERR_TIMEOUT;
     }
-    if (v >= 3.4 && v < 3.6)
+    else
     {
-        return 20;
+        ret = adc_continuous_read(adc1_handle, burst_buf, BATTERY_FRAME_SIZE, &ret_num, 0);
     }
-    if (v >= 3.2 && v < 3.4)
+    adc_continuous_stop(adc1_handle);
+    adc_continuous_flush_pool(adc1_handle); // conversions that arrived before the stop belong to no burst
+    burst_waiter = NULL;
+    if (ret != ESP_OK)
     {
-        return 5;
+        ESP_LOGW(TAG, "Battery burst failed: %s", esp_err_to_name(ret));
+        return ret;
     }
-    return 0;
-}
 
-/**
- * Convert lithium battery voltage to percentage using sigmoid function
- *
- * @param voltage: Battery voltage in volts (typically 3.0V to 4.2V)
- * @return: Battery percentage (0.0 to 100.0)
- */
-float voltage_to_percentage_sigmoid(float voltage)
-{
-    const float V_MIN = 3.0f;      // Minimum voltage (0%)
-    const float V_MAX = 4.2f;      // Maximum voltage (100%)
-    const float V_MID = 3.6f;      // Midpoint voltage (50%)
-    const float steepness = 12.0f; // Controls curve steepness
-
-    // Sigmoid function: 1 / (1 + e^(-k*(x-x0)))
-    float normalized = (voltage - V_MID) * steepness;
-    float sigmoid = 1.0f / (1.0f + expf(-normalized));
-
-    // Scale to 0-100 percentage
-    float percentage = sigmoid * 100.0f;
-
-    // Apply hard limits based on voltage range
-    if (voltage <= V_MIN)
-        percentage = 0.0f;
-    if (voltage >= V_MAX)
-        percentage = 100.0f;
-
-    // Clamp to 0-100 range (safety check)
-    if (percentage < 0.0f)
-        percentage = 0.0f;
-    if (percentage > 100.0f)
-        percentage = 100.0f;
-
-    return percentage;
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= ret_num && sample_count < BATTERY_BURST_SAMPLES; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t *)&burst_buf[i];
+        if (p->type2.channel == EXAMPLE_BATTERY_ADC_CHANNEL)
+        {
+            samples[sample_count++] = p->type2.data;
+        }
+    }
+    if (sample_count == 0)
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    last_adc_median = median(samples, sample_count);
+    float voltage = (raw_to_millivolts(last_adc_median) / 1000.0f) * BATTERY_DIVIDER_FACTOR;
+    if (!have_voltage)
+    {
+        filtered_voltage = voltage;
+        have_voltage = true;
+    }
+    else
+    {
+        filtered_voltage += BATTERY_IIR_ALPHA * (voltage - filtered_voltage);
+    }
+    return ESP_OK;
 }
 
-void battery_get_voltage(float *voltage, uint16_t *adc_value)
+esp_err_t battery_get_voltage(float *voltage, uint16_t *adc_value)
 {
-    int adc_raw;
-    int voltage_int;
-
-    ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, EXAMPLE_BATTERY_ADC_CHANNEL, &adc_raw));
-
-    // ESP_LOGI(TAG, "ADC%d Channel[%d] Raw Data: %d", ADC_UNIT_1 + 1, EXAMPLE_BATTERY_ADC_CHANNEL, adc_raw);
-    if (do_calibration1_chan0)
+    if (!have_voltage)
     {
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc1_cali_chan0_handle, adc_raw, &voltage_int));
-        *voltage = (voltage_int / 1000.0f) * 3.0;
-        *adc_value = adc_raw;
+        return ESP_ERR_INVALID_STATE;
     }
+    *voltage = filtered_voltage;
+    *adc_value = last_adc_median;
+    return ESP_OK;
 }
 
-void check_battery_task(void *params)
+// Called by the controller every 10 s
+void battery_check(void)
 {
-    while (1)
+    float voltage;
+    uint16_t adc_value;
+    battery_measure();
+    if (battery_get_voltage(&voltage, &adc_value) == ESP_OK)
     {
-        vTaskDelay(pdMS_TO_TICKS(10000));
-        float voltage;
-        uint16_t adc_value;
-        battery_get_voltage(&voltage, &adc_value);
-        set_battery(voltage);
-        // ESP_LOGI(TAG, "Battery: %.2f", voltage);
+        battery_soc_t soc;
+        battery_soc_update(voltage);
+        battery_soc_get(&soc);
+        set_battery((uint8_t)(soc.percent + 0.5f));
+        usb_stream_battery((uint16_t)(voltage * 1000), (uint8_t)(soc.percent + 0.5f));
+        ESP_LOGI(TAG, "Battery %.2f V, %.0f%%, %.1f h remaining at %.0f mA", voltage, soc.percent, soc.hours_remaining, soc.load_ma);
+        // the runtime gain per profile is part of the diagnostics snapshot
+        power_profile_update(soc.percent);
     }
-}
\ No newline at end of file
+}
@@ -1,7 +1,8 @@
 #pragma once
+#include <stdint.h>
+#include "esp_err.h"
 
 void battery_init(void);
-void battery_get_voltage(float *voltage, uint16_t *adc_value);
-uint8_t mapBatVolt2Pct(float v);
-float voltage_to_percentage_sigmoid(float voltage);
-void check_battery_task(void *params);
\ No newline at end of file
+esp_err_t battery_measure(void);
+esp_err_t battery_get_voltage(float *voltage, uint16_t *adc_value);
+void battery_check(void);
@@ -3,29 +3,77 @@
 #include "../../scale/ble.h"
 #include "../view01.h"
 #include "../../display/wavesharelcd2/display_init.h"
+#include "diag/latency_trace.h"
+#include "diag/dlog.h"
+#include "shot/shot_log.h"
 #include <esp_err.h>
 #include "esp_sleep.h"
 #include "driver/gpio.h"
 
 static const char *TAG = "scale_ctrl";
 
+// below this the beans are off the dose scale, keep showing the last dose
+#define DOSE_MIN_WEIGHT10 10
+
 void tare_cb()
 {
-    ESP_LOGI(TAG, "TARE Pressed");
+    DLOGI(TAG, "TARE Pressed");
     scale_tare();
 }
 
-void collect_weight_task(void *params)
+// Brew ratio against the last dose the dose scale saw, the beans leave it before the shot starts
+static void update_ratio(int16_t yield10)
+{
+    static int16_t dose10 = 0;
+    static int16_t shown_dose10 = -1;
+    static int16_t shown_yield10 = -1;
+
+    if (!scale_id_connected(SCALE_DOSE))
+    {
+        dose10 = 0;
+    }
+    else if (scale_get_weight10(SCALE_DOSE) >= DOSE_MIN_WEIGHT10)
+    {
+        dose10 = scale_get_weight10(SCALE_DOSE);
+    }
+    if (dose10 != shown_dose10)
+    {
+        shot_log_set_target(dose10 * SHOT_TARGET_RATIO10 / 10);
+    }
+    if (dose10 != shown_dose10 || (dose10 > 0 && yield10 != shown_yield10))
+    {
+        set_ratio(dose10, yield10);
+        shown_dose10 = dose10;
+        shown_yield10 = yield10;
+    }
+}
+
+// Returns true while the cup weight is stale.
+// Off counts as stale too, so the weight is dimmed right after switching on until the scale streams
+bool update_weight_stale(void)
+{
+    static int shown_stale = -1;
+    bool stale = !is_on() || scale_weight_stale(SCALE_CUP);
+    if (stale != shown_stale)
+    {
+        set_weight_stale(stale);
+        shown_stale = stale;
+    }
+    return stale;
+}
+
+// Runs on the controller task for every notification, the label is only touched when the value changed
+void show_weight(void)
 {
-    while (1)
+    static int32_t shown_weight10 = INT32_MIN;
+    int16_t weight10 = get_weight10();
+    if (weight10 != shown_weight10)
     {
-        vTaskDelay(pdMS_TO_TICKS(100));
-        if (is_on())
-        {
-            int16_t weight10 = get_weight10();
-            set_weight(weight10);
-        }
+        latency_trace_consumed();
+        set_weight(weight10);
+        shown_weight10 = weight10;
     }
+    update_ratio(weight10);
 }
 
 void enter_deep_sleep(void)
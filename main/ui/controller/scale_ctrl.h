@@ -1,5 +1,7 @@
 #pragma once
+#include <stdbool.h>
 
 void tare_cb();
-void collect_weight_task(void *params);
+bool update_weight_stale(void);
+void show_weight(void);
 void enter_deep_sleep(void);
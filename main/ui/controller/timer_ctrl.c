@@ -1,107 +1,171 @@
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "esp_log.h"
 #include "timer_ctrl.h"
 #include "scale/ble.h"
+#include "scale/ble_relay.h"
 #include "../view01.h"
+#include "shot/shot_log.h"
+#include "stream/usb_stream.h"
+#include "app_ctrl.h"
+
+// Shot timer state machine.
+//
+// Button callbacks only queue an event and return, they never wait for anything. The controller
+// task is the only one that changes the state: it applies the queued events in order and redraws
+// the timer label afterwards. The state is published as one atomic word, so get_timer_state()
+// needs no lock either.
+
+// a second of taps at 20 a second plus the tick, while set_timer waits up to 1 s for the LVGL lock
+#define TIMER_EVENT_QUEUE 32
+#define TIMER_AUTO_STOP_SECONDS 1800
+#define TIMER_RUNNING_BIT 1u
+
+typedef enum
+{
+    TIMER_EVT_START_STOP,
+    TIMER_EVT_RESET,
+    TIMER_EVT_TICK,
+    TIMER_EVT_AUTO_STOP,
+} timer_event_t;
 
 static const char *TAG = "timer_ctrl";
 
-static int seconds = 0;
-static timer_state_t timer_state = STOPPED;
-static SemaphoreHandle_t timer_mutex = NULL;
+static StaticQueue_t event_queue_buf;
+static uint8_t event_storage[TIMER_EVENT_QUEUE * sizeof(timer_event_t)];
+static QueueHandle_t event_queue = NULL;
 
-void init_timer()
+// seconds shifted left by one, running in bit 0
+static atomic_uint timer_word = 0;
+
+static inline uint32_t make_word(int seconds, timer_state_t state)
 {
-    if (timer_mutex == NULL)
-    {
-        timer_mutex = xSemaphoreCreateMutex();
-    }
+    return ((uint32_t)seconds << 1) | (state == RUNNING ? TIMER_RUNNING_BIT : 0);
 }
 
-timer_state_t get_timer_state()
+void timer_init(void)
 {
-    timer_state_t retval = STOPPED;
+    event_queue = xQueueCreateStatic(TIMER_EVENT_QUEUE, sizeof(timer_event_t), event_storage, &event_queue_buf);
+}
 
-    init_timer();
-    if (xSemaphoreTake(timer_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+static void post(timer_event_t event)
+{
+    if (event_queue == NULL || xQueueSend(event_queue, &event, 0) != pdTRUE)
     {
-        retval = timer_state;
-        xSemaphoreGive(timer_mutex);
+        ESP_LOGE(TAG, "Timer event %d lost", event);
+        return;
     }
-    return retval;
+    app_ctrl_post(CTRL_EVT_TIMER);
+}
+
+timer_state_t get_timer_state()
+{
+    return (atomic_load(&timer_word) & TIMER_RUNNING_BIT) ? RUNNING : STOPPED;
 }
 
 void timer_reset_cb()
 {
-    init_timer();
-    if (xSemaphoreTake(timer_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
-    {
-        if (timer_state == STOPPED)
-        {
-            ESP_LOGI(TAG, "TIMER Reset");
-            seconds = 0;
-            set_timer(seconds);
-            scale_timer_reset();
-            scale_timer_off();
-        }
-        xSemaphoreGive(timer_mutex);
-    }
+    post(TIMER_EVT_RESET);
 }
 
 void timer_start_stop_cb()
 {
-    init_timer();
-    if (xSemaphoreTake(timer_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+    post(TIMER_EVT_START_STOP);
+}
+
+// Only called on the controller task
+static void apply(timer_event_t event)
+{
+    uint32_t word = atomic_load(&timer_word);
+    int seconds = word >> 1;
+    timer_state_t state = (word & TIMER_RUNNING_BIT) ? RUNNING : STOPPED;
+
+    switch (event)
     {
-        switch (timer_state)
+    case TIMER_EVT_START_STOP:
+        if (state == RUNNING)
         {
-        case RUNNING:
             ESP_LOGI(TAG, "TIMER Stop");
             scale_timer_off();
-            timer_state = STOPPED;
-            break;
-        case STOPPED:
+            shot_log_end();
+            usb_stream_timer(STREAM_TIMER_STOP, seconds);
+            ble_relay_timer(seconds, false);
+            state = STOPPED;
+        }
+        else
+        {
             ESP_LOGI(TAG, "TIMER Start");
             scale_timer_on();
-            timer_state = RUNNING;
-            break;
+            shot_log_begin();
+            usb_stream_timer(STREAM_TIMER_START, seconds);
+            ble_relay_timer(seconds, true);
+            state = RUNNING;
+            app_ctrl_need_seconds();
+        }
+        break;
+    case TIMER_EVT_RESET:
+        // a running timer has to be stopped first
+        if (state == STOPPED)
+        {
+            ESP_LOGI(TAG, "TIMER Reset");
+            seconds = 0;
+            scale_timer_reset();
+            scale_timer_off();
+            usb_stream_timer(STREAM_TIMER_RESET, seconds);
+            ble_relay_timer(seconds, false);
         }
-        xSemaphoreGive(timer_mutex);
+        break;
+    case TIMER_EVT_TICK:
+        if (state == RUNNING)
+        {
+            seconds++;
+            ble_relay_timer(seconds, true);
+            if (seconds > TIMER_AUTO_STOP_SECONDS)
+            {
+                post(TIMER_EVT_AUTO_STOP);
+            }
+        }
+        break;
+    case TIMER_EVT_AUTO_STOP:
+        // a stop tapped while this was queued already ended the shot
+        if (state == RUNNING)
+        {
+            ESP_LOGI(TAG, "TIMER Auto stop");
+            seconds = 0;
+            scale_timer_reset();
+            scale_timer_off();
+            shot_log_end();
+            usb_stream_timer(STREAM_TIMER_RESET, seconds);
+            ble_relay_timer(seconds, false);
+            state = STOPPED;
+        }
+        break;
     }
+    atomic_store(&timer_word, make_word(seconds, state));
 }
 
-void timer_task(void *params)
+// Applies everything queued so far, then draws the result once
+void timer_process(void)
 {
-    ESP_LOGI(TAG, "Starting Timer Task");
-    init_timer();
-
-    TickType_t xLastWakeTime;
-    const TickType_t xFrequency = pdMS_TO_TICKS(1000); // 1000ms = 1 second
-
-    // Initialize the xLastWakeTime variable with the current time
-    xLastWakeTime = xTaskGetTickCount();
-
-    while (1)
+    static int shown_seconds = -1;
+    timer_event_t event;
+    while (event_queue != NULL && xQueueReceive(event_queue, &event, 0) == pdTRUE)
     {
-        if (xSemaphoreTake(timer_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
-        {
-            if (timer_state == RUNNING)
-            {
-                // Increment counter
-                seconds++;
-                set_timer(seconds);
-            }
-            if (seconds > 1800)
-            {
-                seconds = 0;
-                set_timer(seconds);
-                scale_timer_reset();
-                scale_timer_off();
-                timer_state = STOPPED;
-            }
-            xSemaphoreGive(timer_mutex);
-        }
-        // Wait for the next cycle (1 second)
-        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        apply(event);
+    }
+    int seconds = atomic_load(&timer_word) >> 1;
+    if (seconds != shown_seconds)
+    {
+        set_timer(seconds);
+        shown_seconds = seconds;
     }
-}
\ No newline at end of file
+}
+
+// Called by the controller once a second while the timer runs. The tick goes through the queue
+// so it lands after presses that came before it.
+void timer_tick(void)
+{
+    post(TIMER_EVT_TICK);
+    timer_process();
+}
@@ -7,4 +7,6 @@ typedef enum {
 void timer_start_stop_cb();
 void timer_reset_cb();
 timer_state_t get_timer_state();
-void timer_task(void *params);
+void timer_init(void);
+void timer_process(void);
+void timer_tick(void);
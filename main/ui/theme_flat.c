@@ -0,0 +1,100 @@
+/*
+ * Flat theme for the black UI: no radius, shadows, gradients, transitions or press transforms, so
+ * every widget is drawn with plain rectangle fills. The styles are const and live in flash, applying
+ * them allocates nothing from the LVGL heap. The default theme stays the parent, so widgets this theme
+ * does not know (charts on the history screen) keep its look; the ones it knows drop its styles again.
+ */
+
+#include "lvgl.h"
+#include "roboto_regular_20.h"
+#include "theme_flat.h"
+
+static const lv_style_const_prop_t scr_props[] = {
+    LV_STYLE_CONST_BG_COLOR(LV_COLOR_MAKE(0x00, 0x00, 0x00)),
+    LV_STYLE_CONST_BG_OPA(LV_OPA_COVER),
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0xff, 0xff, 0xff)),
+    LV_STYLE_CONST_PAD_ROW(8),
+    LV_STYLE_CONST_PAD_COLUMN(8),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_scr, scr_props);
+
+// containers only group and place, the screen behind them is already black
+static const lv_style_const_prop_t pane_props[] = {
+    LV_STYLE_CONST_BG_OPA(LV_OPA_TRANSP),
+    LV_STYLE_CONST_BORDER_WIDTH(0),
+    LV_STYLE_CONST_PAD_TOP(0),
+    LV_STYLE_CONST_PAD_BOTTOM(0),
+    LV_STYLE_CONST_PAD_LEFT(0),
+    LV_STYLE_CONST_PAD_RIGHT(0),
+    LV_STYLE_CONST_PAD_ROW(8),
+    LV_STYLE_CONST_PAD_COLUMN(8),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_pane, pane_props);
+
+static const lv_style_const_prop_t btn_props[] = {
+    LV_STYLE_CONST_BG_COLOR(LV_COLOR_MAKE(0x21, 0x96, 0xf3)),
+    LV_STYLE_CONST_BG_OPA(LV_OPA_COVER),
+    LV_STYLE_CONST_RADIUS(0),
+    LV_STYLE_CONST_BORDER_WIDTH(0),
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0xff, 0xff, 0xff)),
+    LV_STYLE_CONST_TEXT_FONT(&roboto_regular_20),
+    LV_STYLE_CONST_PAD_TOP(10),
+    LV_STYLE_CONST_PAD_BOTTOM(10),
+    LV_STYLE_CONST_PAD_LEFT(10),
+    LV_STYLE_CONST_PAD_RIGHT(10),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_btn, btn_props);
+
+static const lv_style_const_prop_t btn_pressed_props[] = {
+    LV_STYLE_CONST_BG_COLOR(LV_COLOR_MAKE(0x15, 0x65, 0xc0)),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_btn_pressed, btn_pressed_props);
+
+// LVGL applies the parent theme first, so remove_style_all takes the default theme's shadows,
+// radius and transitions off again before the flat styles go on
+static void apply_cb(lv_theme_t *th, lv_obj_t *obj)
+{
+    if (lv_obj_get_parent(obj) == NULL)
+    {
+        lv_obj_remove_style_all(obj);
+        lv_obj_add_style(obj, &style_scr, LV_PART_MAIN);
+    }
+    else if (lv_obj_check_type(obj, &lv_button_class))
+    {
+        lv_obj_remove_style_all(obj);
+        lv_obj_add_style(obj, &style_btn, LV_PART_MAIN);
+        lv_obj_add_style(obj, &style_btn_pressed, LV_PART_MAIN | LV_STATE_PRESSED);
+    }
+    else if (lv_obj_check_type(obj, &lv_obj_class))
+    {
+        lv_obj_remove_style_all(obj);
+        lv_obj_add_style(obj, &style_pane, LV_PART_MAIN);
+    }
+    else if (lv_obj_check_type(obj, &lv_label_class) || lv_obj_check_type(obj, &lv_image_class))
+    {
+        lv_obj_remove_style_all(obj);
+    }
+}
+
+// Replaces the theme of the display, objects created before keep their styles
+void theme_flat_init(lv_display_t *disp)
+{
+    lv_theme_t *theme_flat = lv_theme_create();
+    if (theme_flat == NULL)
+    {
+        return;
+    }
+    // the copy keeps the fonts and colors lv_theme_get_font_normal() and friends hand out
+    lv_theme_t *theme_base = lv_display_get_theme(disp);
+    if (theme_base != NULL)
+    {
+        lv_theme_copy(theme_flat, theme_base);
+    }
+    lv_theme_set_parent(theme_flat, theme_base);
+    lv_theme_set_apply_cb(theme_flat, apply_cb);
+    lv_display_set_theme(disp, theme_flat);
+}
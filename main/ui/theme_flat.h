@@ -0,0 +1,4 @@
+#pragma once
+#include "lvgl.h"
+
+void theme_flat_init(lv_display_t *disp);
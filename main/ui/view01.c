@@ -15,18 +15,24 @@
 #include "ui/controller/battery_ctrl.h"
 #include "ui/controller/timer_ctrl.h"
 #include "ui/controller/scale_ctrl.h"
+#include "ui/controller/app_ctrl.h"
+#include "view_diag.h"
+#include "view_history.h"
+#include "theme_flat.h"
+#include "diag/latency_trace.h"
+#include "diag/dlog.h"
 #include "sdkconfig.h"
 
 static const char *TAG = "view01";
 void bt_connect_scale(void);
 void disconnect_from_scale(void);
 
-static lv_obj_t *lbl_weight, *lbl_battery;
+static lv_obj_t *lbl_weight, *lbl_ratio, *lbl_battery, *lbl_profile;
 static lv_obj_t *lbl_unit, *lbl_timer, *lbl_seconds;
 static lv_obj_t *btn_connect, *btn_tare, *btn_timer;
 static lv_obj_t *lbl_connect, *lbl_tare, *lbl_reset;
 static lv_obj_t *img_battery;
-static lv_style_t style_pane, style_btn;
+static lv_obj_t *main_screen;
 static bool on = false;
 
 bool is_on()
@@ -36,7 +42,7 @@ bool is_on()
 
 void toggle_on()
 {
-    ESP_LOGI(TAG, "ON Pressed");
+    DLOGI(TAG, "ON Pressed");
 
     on = !on;
     if (lvgl_port_lock(1000))
@@ -52,6 +58,8 @@ void toggle_on()
     {
         disconnect_from_scale();
     }
+    // dims or undims the weight
+    app_ctrl_post(CTRL_EVT_WEIGHT);
 }
 
 void power_off(lv_event_t *e)
@@ -61,60 +69,168 @@ void power_off(lv_event_t *e)
     enter_deep_sleep();
 }
 
+void show_diag_cb(lv_event_t *e)
+{
+    show_diag_screen(main_screen);
+    app_ctrl_need_seconds();
+}
+
+void gesture_cb(lv_event_t *e)
+{
+    if (lv_indev_get_gesture_dir(lv_indev_active()) == LV_DIR_LEFT)
+    {
+        show_history_screen(main_screen);
+    }
+}
+
 void default_cb()
 {
     ESP_LOGI(TAG, "Default CB");
 }
 
+// Widest text each live label can show. The label gets a fixed box of that width, so a new value
+// only redraws the label itself and never makes the flex layout move its neighbours.
+#define WEIGHT_TEMPLATE "-8888.8" // int16 in 0.1 g, -3276.8 to 3276.7
+#define RATIO_TEMPLATE "Dose 88.8  1:88.8"
+#define TIMER_TEMPLATE "88:88"
+#define BATTERY_TEMPLATE "100%"
+#define PROFILE_TEMPLATE "SAVE"
+
+// Shared by all labels that use them, const so they cost no LVGL heap
+static const lv_style_const_prop_t caption_props[] = {
+    LV_STYLE_CONST_TEXT_FONT(&roboto_regular_20),
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0xcc, 0xcc, 0xcc)),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_caption, caption_props);
+
+static const lv_style_const_prop_t weight_props[] = {
+    LV_STYLE_CONST_TEXT_FONT(&roboto_bold_60),
+    LV_STYLE_CONST_MARGIN_BOTTOM(10),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_weight, weight_props);
+
+static const lv_style_const_prop_t timer_props[] = {
+    LV_STYLE_CONST_TEXT_FONT(&roboto_bold_40),
+    LV_STYLE_CONST_MARGIN_BOTTOM(10),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_timer, timer_props);
+
+static const lv_style_const_prop_t status_props[] = {
+    LV_STYLE_CONST_TEXT_FONT(&roboto_regular_20),
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0xbb, 0xbb, 0xbb)),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_status, status_props);
+
+// Live labels paint their own box black. LVGL starts redrawing a dirty area at the topmost object
+// that covers it, so a new value only draws the label's fill and its glyphs, and the screen,
+// panes and captions are not drawn again at notification rate.
+static const lv_style_const_prop_t live_props[] = {
+    LV_STYLE_CONST_BG_COLOR(LV_COLOR_MAKE(0x00, 0x00, 0x00)),
+    LV_STYLE_CONST_BG_OPA(LV_OPA_COVER),
+    LV_STYLE_CONST_TEXT_ALIGN(LV_TEXT_ALIGN_RIGHT),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_live, live_props);
+
+static const lv_style_const_prop_t data_pane_props[] = {
+    LV_STYLE_CONST_PAD_TOP(5),
+    LV_STYLE_CONST_PAD_BOTTOM(5),
+    LV_STYLE_CONST_PAD_LEFT(5),
+    LV_STYLE_CONST_PAD_RIGHT(5),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_data_pane, data_pane_props);
+
+static const lv_style_const_prop_t profile_props[] = {
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0xaa, 0xaa, 0x00)),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_profile, profile_props);
+
+// Values that change at run time switch a state, the styles for each state are added once
+#define STATE_STALE LV_STATE_USER_1
+#define STATE_BATTERY_OK LV_STATE_USER_1
+#define STATE_BATTERY_HALF LV_STATE_USER_2
+#define STATE_BATTERY_LOW LV_STATE_USER_3
+
+static const lv_style_const_prop_t stale_props[] = {
+    LV_STYLE_CONST_TEXT_OPA(LV_OPA_40),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_stale, stale_props);
+
+static const lv_style_const_prop_t battery_ok_props[] = {
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0x00, 0xaa, 0x00)),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_battery_ok, battery_ok_props);
+
+static const lv_style_const_prop_t battery_half_props[] = {
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0x00, 0xaa, 0xaa)),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_battery_half, battery_half_props);
+
+static const lv_style_const_prop_t battery_low_props[] = {
+    LV_STYLE_CONST_TEXT_COLOR(LV_COLOR_MAKE(0xaa, 0x00, 0x00)),
+    LV_STYLE_CONST_PROPS_END,
+};
+static LV_STYLE_CONST_INIT(style_battery_low, battery_low_props);
+
+static int32_t text_width(const char *text, const lv_font_t *font)
+{
+    lv_point_t size;
+    lv_text_get_size(&size, text, font, 0, 0, LV_COORD_MAX, LV_TEXT_FLAG_NONE);
+    return size.x;
+}
+
+static void fix_label_geometry(lv_obj_t *label, const char *template, const lv_font_t *font)
+{
+    lv_label_set_long_mode(label, LV_LABEL_LONG_MODE_CLIP);
+    lv_obj_set_size(label, text_width(template, font), lv_font_get_line_height(font));
+    lv_obj_add_style(label, &style_live, LV_PART_MAIN);
+}
+
 void make_widget_tree()
 {
+    /* Task lock */
+    lvgl_port_lock(1000);
+
     // setup screen
     lv_obj_t *screen = lv_scr_act();
+    main_screen = screen;
+    lv_obj_add_event_cb(screen, gesture_cb, LV_EVENT_GESTURE, NULL);
 
-    /* Task lock */
-    lvgl_port_lock(1000);
+    // panes and buttons get their look from the flat theme, the screen already exists and needs it applied
+    theme_flat_init(lv_obj_get_display(screen));
+    lv_theme_apply(screen);
 
     lv_obj_set_scrollbar_mode(screen, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_bg_color(screen, lv_color_black(), LV_PART_MAIN);
     lv_obj_set_layout(screen, LV_LAYOUT_FLEX);
     lv_obj_set_flex_flow(screen, LV_FLEX_FLOW_ROW);
     lv_obj_set_flex_align(screen, LV_FLEX_ALIGN_SPACE_EVENLY, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START);
-    lv_obj_set_style_text_color(lv_screen_active(), lv_color_hex(0xffffff), LV_PART_MAIN);
-
-    // panestyle
-    lv_style_init(&style_pane);
-    lv_style_set_border_width(&style_pane, 0);
-    lv_style_set_flex_grow(&style_pane, 0);
-    lv_style_set_pad_all(&style_pane, 0);
-
-    // button style
-    lv_style_init(&style_btn);
-    lv_style_set_pad_all(&style_btn, 10);
-    lv_style_set_pad_gap(&style_btn, 10);
-    lv_style_set_margin_all(&style_btn, 0);
 
     // panes
     lv_obj_t *buttons_pane = lv_obj_create(screen);
-    lv_obj_add_style(buttons_pane, &style_pane, LV_PART_MAIN | LV_STATE_DEFAULT);
     lv_obj_set_height(buttons_pane, LV_PCT(100));
     lv_obj_set_layout(buttons_pane, LV_LAYOUT_FLEX);
     lv_obj_set_flex_flow(buttons_pane, LV_FLEX_FLOW_COLUMN);
     lv_obj_set_flex_align(buttons_pane, LV_FLEX_ALIGN_SPACE_BETWEEN, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START);
     lv_obj_set_flex_grow(buttons_pane, 3);
-    lv_obj_set_style_bg_color(buttons_pane, lv_color_black(), LV_PART_MAIN);
 
     lv_obj_t *data_pane = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(data_pane, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_width(data_pane, LV_PCT(100));
     lv_obj_set_height(data_pane, LV_PCT(100));
-    lv_obj_add_style(data_pane, &style_pane, LV_PART_MAIN | LV_STATE_DEFAULT);
     lv_obj_set_layout(data_pane, LV_LAYOUT_FLEX);
     lv_obj_set_flex_flow(data_pane, LV_FLEX_FLOW_COLUMN);
     lv_obj_set_flex_align(data_pane, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_END, LV_FLEX_ALIGN_END);
     lv_obj_set_flex_grow(data_pane, 6);
-    lv_obj_set_style_bg_color(data_pane, lv_color_black(), LV_PART_MAIN);
-    lv_obj_set_style_text_color(data_pane, lv_color_white(), LV_PART_MAIN);
-    lv_obj_set_style_pad_all(data_pane, 5, LV_PART_MAIN);
+    lv_obj_add_style(data_pane, &style_data_pane, LV_PART_MAIN);
 
     // buttons
     btn_connect = lv_button_create(buttons_pane);
@@ -124,7 +240,6 @@ void make_widget_tree()
     lbl_connect = lv_label_create(btn_connect);
     lv_label_set_text(lbl_connect, is_on() ? "OFF" : "ON");
     lv_obj_align(lbl_connect, LV_ALIGN_CENTER, 0, 0);
-    lv_obj_set_style_text_font(lbl_connect, &roboto_regular_20, LV_PART_MAIN);
     lv_obj_set_flex_grow(btn_connect, 1);
 
     btn_tare = lv_button_create(buttons_pane);
@@ -133,9 +248,7 @@ void make_widget_tree()
     lbl_tare = lv_label_create(btn_tare);
     lv_label_set_text(lbl_tare, "TARE");
     lv_obj_align(lbl_tare, LV_ALIGN_CENTER, 0, 0);
-    lv_obj_set_style_text_font(lbl_tare, &roboto_regular_20, LV_PART_MAIN);
     lv_obj_set_flex_grow(btn_tare, 1);
-    lv_obj_add_style(btn_tare, &style_btn, LV_PART_MAIN);
 
     btn_timer = lv_button_create(buttons_pane);
     lv_obj_set_width(btn_timer, LV_PCT(100));
@@ -144,7 +257,6 @@ void make_widget_tree()
     lbl_reset = lv_label_create(btn_timer);
     lv_label_set_text(lbl_reset, "TIMER");
     lv_obj_align(lbl_reset, LV_ALIGN_CENTER, 0, 0);
-    lv_obj_set_style_text_font(lbl_reset, &roboto_regular_20, LV_PART_MAIN);
     lv_obj_set_flex_grow(btn_timer, 1);
 
     // labels / fields
@@ -153,42 +265,57 @@ void make_widget_tree()
     lv_obj_add_flag(lbl_unit, LV_OBJ_FLAG_CLICKABLE);
     lv_obj_add_event_cb(lbl_unit, tare_cb, LV_EVENT_CLICKED, NULL);
     lv_label_set_text(lbl_unit, "Weight");
-    lv_obj_set_style_text_font(lbl_unit, &roboto_regular_20, LV_PART_MAIN);
-    lv_obj_set_style_text_color(lbl_unit, lv_color_hex(0xcccccc), LV_PART_MAIN);
+    lv_obj_add_style(lbl_unit, &style_caption, LV_PART_MAIN);
 
     lbl_weight = lv_label_create(data_pane);
     lv_obj_add_flag(lbl_weight, LV_OBJ_FLAG_CLICKABLE);
     lv_obj_add_event_cb(lbl_weight, tare_cb, LV_EVENT_CLICKED, NULL);
     lv_label_set_text(lbl_weight, "0.0");
-    lv_obj_set_style_text_font(lbl_weight, &roboto_bold_60, LV_PART_MAIN);
-    lv_obj_set_style_margin_bottom(lbl_weight, 10, LV_PART_MAIN);
+    lv_obj_add_style(lbl_weight, &style_weight, LV_PART_MAIN);
+    lv_obj_add_style(lbl_weight, &style_stale, LV_PART_MAIN | STATE_STALE);
+    fix_label_geometry(lbl_weight, WEIGHT_TEMPLATE, &roboto_bold_60);
+
+    // dose and brew ratio, only shown while a dose scale is connected
+    lbl_ratio = lv_label_create(data_pane);
+    lv_label_set_text(lbl_ratio, "");
+    lv_obj_add_style(lbl_ratio, &style_caption, LV_PART_MAIN);
+    fix_label_geometry(lbl_ratio, RATIO_TEMPLATE, &roboto_regular_20);
+    lv_obj_add_flag(lbl_ratio, LV_OBJ_FLAG_HIDDEN);
 
     // timer
     lbl_seconds = lv_label_create(data_pane);
     lv_label_set_text(lbl_seconds, "Timer");
-    lv_obj_set_style_text_font(lbl_seconds, &roboto_regular_20, LV_PART_MAIN);
-    lv_obj_set_style_text_color(lbl_seconds, lv_color_hex(0xcccccc), LV_PART_MAIN);
+    lv_obj_add_style(lbl_seconds, &style_caption, LV_PART_MAIN);
 
     lbl_timer = lv_label_create(data_pane);
     lv_label_set_text(lbl_timer, "00:00");
-    lv_obj_set_style_text_font(lbl_timer, &roboto_bold_40, LV_PART_MAIN);
-    lv_obj_set_style_margin_bottom(lbl_timer, 10, LV_PART_MAIN);
+    lv_obj_add_style(lbl_timer, &style_timer, LV_PART_MAIN);
+    fix_label_geometry(lbl_timer, TIMER_TEMPLATE, &roboto_bold_40);
 
     // battery
     lv_obj_t *bat_widget = lv_obj_create(data_pane);
     lv_obj_set_flex_flow(bat_widget, LV_FLEX_FLOW_ROW);
     lv_obj_set_flex_align(bat_widget, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER);
-    lv_obj_set_style_bg_color(bat_widget, lv_color_black(), LV_PART_MAIN);
-    lv_obj_set_style_text_color(bat_widget, lv_color_hex(0xbbbbbb), LV_PART_MAIN);
-    lv_obj_set_style_border_width(bat_widget, 0, LV_PART_MAIN);
+    lv_obj_add_style(bat_widget, &style_status, LV_PART_MAIN);
+    lv_obj_add_flag(bat_widget, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_add_event_cb(bat_widget, show_diag_cb, LV_EVENT_LONG_PRESSED, NULL);
+
+    lbl_profile = lv_label_create(bat_widget);
+    lv_label_set_text(lbl_profile, "");
+    lv_obj_add_style(lbl_profile, &style_profile, LV_PART_MAIN);
+    fix_label_geometry(lbl_profile, PROFILE_TEMPLATE, &roboto_regular_20);
 
     lbl_battery = lv_label_create(bat_widget);
     lv_label_set_text(lbl_battery, CONFIG_APP_PROJECT_VER);
-    lv_obj_set_style_text_font(lbl_battery, &roboto_regular_20, LV_PART_MAIN);
+    // wide enough for the version shown until the first battery reading
+    fix_label_geometry(lbl_battery, strlen(CONFIG_APP_PROJECT_VER) > strlen(BATTERY_TEMPLATE) ? CONFIG_APP_PROJECT_VER : BATTERY_TEMPLATE,
+                       &roboto_regular_20);
     img_battery = lv_image_create(bat_widget);
     lv_image_set_src(img_battery, LV_SYMBOL_BATTERY_FULL);
+    lv_obj_add_style(img_battery, &style_battery_ok, LV_PART_MAIN | STATE_BATTERY_OK);
+    lv_obj_add_style(img_battery, &style_battery_half, LV_PART_MAIN | STATE_BATTERY_HALF);
+    lv_obj_add_style(img_battery, &style_battery_low, LV_PART_MAIN | STATE_BATTERY_LOW);
     lv_obj_set_size(bat_widget, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
-    lv_obj_set_style_pad_all(bat_widget, 0, 0);
 
     lvgl_port_unlock();
 }
@@ -206,40 +333,91 @@ void set_weight(int16_t weight)
         if (lbl_weight != NULL)
         {
             lv_label_set_text_fmt(lbl_weight, "%s", str_weight);
+            latency_trace_invalidated();
+        }
+        lvgl_port_unlock();
+    }
+}
+
+// Dims the weight while the scale is not delivering, the last value stays readable
+void set_weight_stale(bool stale)
+{
+    if (lvgl_port_lock(100))
+    {
+        if (lbl_weight != NULL)
+        {
+            if (stale)
+            {
+                lv_obj_add_state(lbl_weight, STATE_STALE);
+            }
+            else
+            {
+                lv_obj_remove_state(lbl_weight, STATE_STALE);
+            }
         }
         lvgl_port_unlock();
     }
 }
 
-int round_to_int(float x)
+// dose10 <= 0 hides the line
+void set_ratio(int16_t dose10, int16_t yield10)
 {
-    return (int)(x + (x >= 0 ? 0.5f : -0.5f));
+    // LVGL's own sprintf has no floats, the text is formatted here like the weight
+    char str_ratio[32] = "";
+    if (dose10 > 0)
+    {
+        snprintf(str_ratio, sizeof(str_ratio), "Dose %.1f  1:%.1f", dose10 / 10.0f, (float)yield10 / dose10);
+    }
+    if (lvgl_port_lock(100))
+    {
+        if (lbl_ratio != NULL)
+        {
+            if (dose10 > 0)
+            {
+                lv_label_set_text_fmt(lbl_ratio, "%s", str_ratio);
+                lv_obj_remove_flag(lbl_ratio, LV_OBJ_FLAG_HIDDEN);
+            }
+            else
+            {
+                lv_obj_add_flag(lbl_ratio, LV_OBJ_FLAG_HIDDEN);
+            }
+        }
+        lvgl_port_unlock();
+    }
 }
 
-void set_battery(float voltage)
+void set_battery(uint8_t bat_percent)
 {
-    // char str_voltage[20];
-    // snprintf(str_voltage, sizeof(str_voltage), "%.1f", voltage);
-    char bat_percent[20];
-    snprintf(bat_percent, sizeof(bat_percent), "%d %%", round_to_int(voltage_to_percentage_sigmoid(voltage)));
-    // ESP_LOGI(TAG, "Set Battery percent to %s", percent);
     if (lvgl_port_lock(1000))
     {
         if (lbl_battery != NULL)
         {
             lv_image_set_src(img_battery, LV_SYMBOL_BATTERY_FULL);
-            int bat_percent = round_to_int(voltage_to_percentage_sigmoid(voltage));
             lv_label_set_text_fmt(lbl_battery, "%d%%", bat_percent);
-            uint32_t color = 0x00aa00; // green
+            lv_state_t state = STATE_BATTERY_OK;
             if (bat_percent < 40)
             {
-                color = 0x00aaaa;
+                state = STATE_BATTERY_HALF;
             }
             if (bat_percent < 15)
             {
-                color = 0xaa0000;
+                state = STATE_BATTERY_LOW;
             }
-            lv_obj_set_style_text_color(img_battery, lv_color_hex(color), LV_PART_MAIN);
+            // unchanged states cost nothing, LVGL only restyles when the state differs
+            lv_obj_remove_state(img_battery, (STATE_BATTERY_OK | STATE_BATTERY_HALF | STATE_BATTERY_LOW) & ~state);
+            lv_obj_add_state(img_battery, state);
+        }
+        lvgl_port_unlock();
+    }
+}
+
+void set_power_profile(const char *name)
+{
+    if (lvgl_port_lock(1000))
+    {
+        if (lbl_profile != NULL)
+        {
+            lv_label_set_text(lbl_profile, name);
         }
         lvgl_port_unlock();
     }
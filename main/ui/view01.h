@@ -4,7 +4,10 @@
 
 void make_widget_tree(void);
 void set_weight(int16_t);
+void set_weight_stale(bool stale);
+void set_ratio(int16_t dose10, int16_t yield10);
 void set_timer(int);
-void set_battery(float voltage);
+void set_battery(uint8_t percent);
+void set_power_profile(const char *name);
 bool is_on();
 void toggle_on();
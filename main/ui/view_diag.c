@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include "view_diag.h"
+#include "lvgl.h"
+#include "esp_lvgl_port.h"
+#include "esp_log.h"
+#include "diag/dlog.h"
+
+// Hidden diagnostics screen, opened by a long press on the battery widget.
+// Tapping anywhere returns to the main view.
+
+static const char *TAG = "view_diag";
+
+static lv_obj_t *diag_screen = NULL;
+static lv_obj_t *lbl_diag = NULL;
+static lv_obj_t *main_screen = NULL;
+static bool active = false;
+static char diag_text[2048];
+
+static void close_cb(lv_event_t *e)
+{
+    DLOGI(TAG, "Close diagnostics");
+    active = false;
+    lv_screen_load(main_screen);
+}
+
+// must be called with the lvgl port lock held
+static void make_diag_tree()
+{
+    diag_screen = lv_obj_create(NULL);
+    lv_obj_set_scrollbar_mode(diag_screen, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_style_bg_color(diag_screen, lv_color_black(), LV_PART_MAIN);
+    lv_obj_set_style_pad_all(diag_screen, 2, LV_PART_MAIN);
+    lv_obj_add_event_cb(diag_screen, close_cb, LV_EVENT_CLICKED, NULL);
+
+    lbl_diag = lv_label_create(diag_screen);
+    lv_obj_set_style_text_font(lbl_diag, &lv_font_unscii_8, LV_PART_MAIN);
+    lv_obj_set_style_text_color(lbl_diag, lv_color_hex(0xcccccc), LV_PART_MAIN);
+    lv_label_set_text(lbl_diag, "collecting...");
+}
+
+// Called from an LVGL event callback, the port lock is already held
+void show_diag_screen(lv_obj_t *back_screen)
+{
+    DLOGI(TAG, "Open diagnostics");
+    main_screen = back_screen;
+    if (diag_screen == NULL)
+    {
+        make_diag_tree();
+    }
+    active = true;
+    lv_screen_load(diag_screen);
+}
+
+bool view_diag_active()
+{
+    return active;
+}
+
+// The label renders straight from diag_text, so the buffer is only written with the port lock held
+void view_diag_update(const diag_snapshot_t *snap)
+{
+    if (!lvgl_port_lock(100))
+    {
+        return;
+    }
+    if (active && lbl_diag != NULL)
+    {
+        int n = snprintf(diag_text, sizeof(diag_text), "%-16s%4s%6s%8s\n", "TASK", "PRI", "CPU%", "STACK");
+        for (int i = 0; i < snap->task_count && n < sizeof(diag_text); i++)
+        {
+            const diag_task_t *t = &snap->tasks[i];
+            n += snprintf(diag_text + n, sizeof(diag_text) - n, "%-16.16s%4u%6.1f%8lu\n",
+                          t->name, t->priority, t->cpu_pct, t->stack_free_bytes);
+        }
+        if (n < sizeof(diag_text))
+        {
+            n += snprintf(diag_text + n, sizeof(diag_text) - n,
+                          "\nINTERNAL free %u largest %u min %u\nPSRAM    free %u largest %u\nLVGL     free %lu/%lu frag %u%% max %lu",
+                          snap->internal_free, snap->internal_largest, snap->internal_min_free,
+                          snap->psram_free, snap->psram_largest,
+                          snap->lv_free, snap->lv_total, snap->lv_frag_pct, snap->lv_max_used);
+        }
+        if (n < sizeof(diag_text))
+        {
+            snprintf(diag_text + n, sizeof(diag_text) - n, "\nRUNTIME  %.1f h  ECO +%.1f  SAVE +%.1f  LOW +%.1f",
+                     snap->hours_remaining, snap->profile_gain_h[POWER_PROFILE_ECO],
+                     snap->profile_gain_h[POWER_PROFILE_SAVER], snap->profile_gain_h[POWER_PROFILE_CRITICAL]);
+        }
+        lv_label_set_text_static(lbl_diag, diag_text);
+    }
+    lvgl_port_unlock();
+}
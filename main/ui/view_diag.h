@@ -0,0 +1,8 @@
+#pragma once
+#include <stdbool.h>
+#include "lvgl.h"
+#include "diag/diagnostics.h"
+
+void show_diag_screen(lv_obj_t *back_screen);
+bool view_diag_active();
+void view_diag_update(const diag_snapshot_t *snap);
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include "view_history.h"
+#include "lvgl.h"
+#include "esp_log.h"
+#include "diag/dlog.h"
+#include "roboto_regular_20.h"
+#include "shot/shot_log.h"
+
+// Shot history, opened by swiping left on the main view.
+//
+// The widget tree is built once on first use and reused afterwards. Only HISTORY_ROWS headers are
+// held in RAM and the selected curve is decoded into a fixed buffer, so the memory used does not
+// depend on the number of shots in flash.
+
+#define HISTORY_ROWS 5
+#define HISTORY_CURVE_POINTS 100
+#define HISTORY_LIST_WIDTH 130
+#define HISTORY_ROW_HEIGHT 40
+
+static const char *TAG = "view_history";
+
+static lv_obj_t *history_screen = NULL;
+static lv_obj_t *main_screen = NULL;
+static lv_obj_t *btn_rows[HISTORY_ROWS];
+static lv_obj_t *lbl_rows[HISTORY_ROWS];
+static lv_obj_t *chart = NULL;
+static lv_chart_series_t *series = NULL;
+static lv_obj_t *lbl_info = NULL;
+
+static shot_entry_t entries[HISTORY_ROWS];
+static int entry_count = 0;
+static int page = 0;
+static int16_t curve[HISTORY_CURVE_POINTS];
+static int32_t chart_points[HISTORY_CURVE_POINTS];
+
+// LVGL keeps at least one point in a chart, so an empty curve is hidden instead
+static void clear_curve(const char *info)
+{
+    lv_label_set_text(lbl_info, info);
+    lv_chart_hide_series(chart, series, true);
+}
+
+static void show_curve(int row)
+{
+    const shot_header_t *hdr = &entries[row].hdr;
+    int n = shot_log_decode_curve(&entries[row], curve, HISTORY_CURVE_POINTS);
+    if (n <= 0)
+    {
+        clear_curve(n < 0 ? "corrupt record" : "no samples");
+        return;
+    }
+
+    int32_t max = 10;
+    for (int i = 0; i < n; i++)
+    {
+        chart_points[i] = curve[i];
+        if (curve[i] > max)
+        {
+            max = curve[i];
+        }
+    }
+    lv_chart_set_point_count(chart, n);
+    lv_chart_hide_series(chart, series, false);
+    lv_chart_set_range(chart, LV_CHART_AXIS_PRIMARY_Y, 0, max);
+    lv_chart_refresh(chart);
+
+    char info[48];
+    snprintf(info, sizeof(info), "%.1f g  %.1f s  %.1f g/s", hdr->final_weight10 / 10.0f, hdr->duration_ds / 10.0f, hdr->peak_flow10 / 10.0f);
+    lv_label_set_text(lbl_info, info);
+}
+
+static void load_page()
+{
+    entry_count = shot_log_read_page(page * HISTORY_ROWS, entries, HISTORY_ROWS);
+    for (int i = 0; i < HISTORY_ROWS; i++)
+    {
+        if (i < entry_count)
+        {
+            char row[24];
+            snprintf(row, sizeof(row), "#%lu %.1fg", entries[i].hdr.seq, entries[i].hdr.final_weight10 / 10.0f);
+            lv_label_set_text(lbl_rows[i], row);
+            lv_obj_remove_flag(btn_rows[i], LV_OBJ_FLAG_HIDDEN);
+        }
+        else
+        {
+            lv_obj_add_flag(btn_rows[i], LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+    if (entry_count > 0)
+    {
+        show_curve(0);
+    }
+    else
+    {
+        clear_curve("no shots recorded");
+    }
+}
+
+static void row_cb(lv_event_t *e)
+{
+    int row = (int)(intptr_t)lv_event_get_user_data(e);
+    if (row < entry_count)
+    {
+        show_curve(row);
+    }
+}
+
+static void page_cb(lv_event_t *e)
+{
+    int step = (int)(intptr_t)lv_event_get_user_data(e);
+    if (page + step < 0 || (step > 0 && entry_count < HISTORY_ROWS))
+    {
+        return;
+    }
+    page += step;
+    load_page();
+    if (entry_count == 0 && page > 0)
+    {
+        page--;
+        load_page();
+    }
+}
+
+static void close_cb(lv_event_t *e)
+{
+    if (lv_event_get_code(e) == LV_EVENT_GESTURE && lv_indev_get_gesture_dir(lv_indev_active()) != LV_DIR_RIGHT)
+    {
+        return;
+    }
+    DLOGI(TAG, "Close history");
+    lv_screen_load(main_screen);
+}
+
+static lv_obj_t *make_button(lv_obj_t *parent, const char *text, lv_event_cb_t cb, intptr_t user_data)
+{
+    lv_obj_t *btn = lv_button_create(parent);
+    lv_obj_add_event_cb(btn, cb, LV_EVENT_CLICKED, (void *)user_data);
+    lv_obj_t *lbl = lv_label_create(btn);
+    lv_label_set_text(lbl, text);
+    lv_obj_center(lbl);
+    return btn;
+}
+
+// must be called with the lvgl port lock held
+static void make_history_tree()
+{
+    history_screen = lv_obj_create(NULL);
+    lv_obj_set_scrollbar_mode(history_screen, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_style_bg_color(history_screen, lv_color_black(), LV_PART_MAIN);
+    lv_obj_set_style_text_color(history_screen, lv_color_white(), LV_PART_MAIN);
+    lv_obj_set_style_text_font(history_screen, &lv_font_montserrat_14, LV_PART_MAIN);
+    lv_obj_add_event_cb(history_screen, close_cb, LV_EVENT_GESTURE, NULL);
+
+    for (int i = 0; i < HISTORY_ROWS; i++)
+    {
+        btn_rows[i] = make_button(history_screen, "", row_cb, i);
+        lv_obj_set_pos(btn_rows[i], 0, i * HISTORY_ROW_HEIGHT);
+        lv_obj_set_size(btn_rows[i], HISTORY_LIST_WIDTH, HISTORY_ROW_HEIGHT - 4);
+        lbl_rows[i] = lv_obj_get_child(btn_rows[i], 0);
+        lv_obj_set_style_text_font(lbl_rows[i], &roboto_regular_20, LV_PART_MAIN);
+    }
+
+    int nav_y = HISTORY_ROWS * HISTORY_ROW_HEIGHT;
+    lv_obj_t *btn_prev = make_button(history_screen, LV_SYMBOL_LEFT, page_cb, -1);
+    lv_obj_set_pos(btn_prev, 0, nav_y);
+    lv_obj_set_size(btn_prev, 36, 36);
+    lv_obj_t *btn_back = make_button(history_screen, "BACK", close_cb, 0);
+    lv_obj_set_pos(btn_back, 40, nav_y);
+    lv_obj_set_size(btn_back, 50, 36);
+    lv_obj_t *btn_next = make_button(history_screen, LV_SYMBOL_RIGHT, page_cb, 1);
+    lv_obj_set_pos(btn_next, 94, nav_y);
+    lv_obj_set_size(btn_next, 36, 36);
+
+    chart = lv_chart_create(history_screen);
+    lv_obj_set_pos(chart, HISTORY_LIST_WIDTH + 5, 0);
+    lv_obj_set_size(chart, LV_HOR_RES - HISTORY_LIST_WIDTH - 10, nav_y - 4);
+    lv_chart_set_type(chart, LV_CHART_TYPE_LINE);
+    lv_chart_set_div_line_count(chart, 4, 0);
+    lv_obj_set_style_bg_color(chart, lv_color_black(), LV_PART_MAIN);
+    lv_obj_set_style_size(chart, 0, 0, LV_PART_INDICATOR);
+    series = lv_chart_add_series(chart, lv_color_hex(0x00aa00), LV_CHART_AXIS_PRIMARY_Y);
+    // the chart draws straight from chart_points, LVGL does not allocate per point
+    lv_chart_set_ext_y_array(chart, series, chart_points);
+
+    lbl_info = lv_label_create(history_screen);
+    lv_obj_set_pos(lbl_info, HISTORY_LIST_WIDTH + 5, nav_y + 8);
+    lv_label_set_text(lbl_info, "");
+}
+
+// Called from an LVGL event callback, the port lock is already held
+void show_history_screen(lv_obj_t *back_screen)
+{
+    DLOGI(TAG, "Open history");
+    main_screen = back_screen;
+    if (history_screen == NULL)
+    {
+        make_history_tree();
+    }
+    page = 0;
+    load_page();
+    lv_screen_load(history_screen);
+}
@@ -0,0 +1,4 @@
+#pragma once
+#include "lvgl.h"
+
+void show_history_screen(lv_obj_t *back_screen);
@@ -0,0 +1,63 @@
+/*
+ * Host test for the command frames of the scale drivers. Every frame a driver encodes is compared
+ * with the bytes the scale maker documents, so a computed checksum can't drift from what the scale
+ * accepts. Commands a scale does not know must encode to nothing.
+ *
+ * Build and run from the repository root:
+ *
+ *   gcc -std=gnu11 -O2 -Wall -Itools/driver_frames/stubs -Imain \
+ *       tools/driver_frames/driver_frames.c main/scale/drivers/bookoo.c -o /tmp/driver_frames && /tmp/driver_frames
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "scale/scale_driver.h"
+
+typedef struct
+{
+    const scale_driver_t *driver;
+    scale_cmd_t cmd;
+    const char *what;
+    uint8_t len; // 0 = the scale has no such command
+    uint8_t frame[SCALE_CMD_MAX];
+} documented_frame_t;
+
+static const documented_frame_t frames[] = {
+    {&scale_driver_bookoo, SCALE_CMD_TARE, "bookoo tare", 6, {0x03, 0x0a, 0x01, 0x00, 0x00, 0x08}},
+    {&scale_driver_bookoo, SCALE_CMD_TIMER_START, "bookoo timer start", 6, {0x03, 0x0a, 0x04, 0x00, 0x00, 0x0a}},
+    {&scale_driver_bookoo, SCALE_CMD_TIMER_STOP, "bookoo timer stop", 6, {0x03, 0x0a, 0x05, 0x00, 0x00, 0x0d}},
+    {&scale_driver_bookoo, SCALE_CMD_TIMER_RESET, "bookoo timer reset", 6, {0x03, 0x0a, 0x06, 0x00, 0x00, 0x0c}},
+    {&scale_driver_bookoo, SCALE_CMD_LED_OFF, "bookoo led off", 0, {0}},
+    {&scale_driver_bookoo, SCALE_CMD_HEARTBEAT, "bookoo heartbeat", 0, {0}},
+};
+
+static void print_frame(const char *label, const uint8_t *frame, uint8_t len)
+{
+    printf("  %-5s", label);
+    for (int i = 0; i < len; i++)
+    {
+        printf(" %02x", frame[i]);
+    }
+    printf("\n");
+}
+
+int main(void)
+{
+    int failures = 0;
+    for (int i = 0; i < sizeof(frames) / sizeof(frames[0]); i++)
+    {
+        const documented_frame_t *f = &frames[i];
+        uint8_t out[SCALE_CMD_MAX] = {0};
+        uint8_t len = f->driver->encode(f->cmd, out);
+        bool ok = len == f->len && memcmp(out, f->frame, len) == 0;
+        printf("%-24s %s\n", f->what, ok ? "ok" : "FAIL");
+        if (!ok)
+        {
+            print_frame("got", out, len);
+            print_frame("want", f->frame, f->len);
+            failures++;
+        }
+    }
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Record the binary sample stream of the scale remote.
+
+Switches streaming on, decodes the frames sent over the native USB port and writes
+one CSV line per record. Log text that shares the port is passed through to stderr.
+
+    pip install pyserial
+    ./stream_decode.py /dev/ttyACM0 shot.csv
+
+Frame layout (little endian), see main/stream/usb_stream.c:
+
+    0xA5 0x5A | type | len | seq | payload[len] | crc8 (poly 0x07 over type..payload)
+"""
+
+import struct
+import sys
+
+import serial
+
+SOF = b"\xa5\x5a"
+RECORDS = {
+    0x01: ("weight", "<Ih", ("weight_g",), (10.0,)),
+    0x02: ("timer", "<IBH", ("event", "seconds"), (1, 1)),
+    0x03: ("battery", "<IHB", ("volts", "percent"), (1000.0, 1)),
+}
+TIMER_EVENTS = {0: "start", 1: "stop", 2: "reset"}
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+class Decoder:
+    def __init__(self, out):
+        self.out = out
+        self.buf = bytearray()
+        self.text = bytearray()
+        self.last_seq = None
+        self.lost = 0
+        self.bad_crc = 0
+        # the device sends a 32 bit microsecond clock, unwrap it to a 64 bit one
+        self.last_t = None
+        self.t_offset = 0
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            start = self.buf.find(SOF)
+            if start < 0:
+                # keep a possible first start byte at the end
+                keep = 1 if self.buf[-1:] == SOF[:1] else 0
+                self.passthrough(self.buf[: len(self.buf) - keep])
+                del self.buf[: len(self.buf) - keep]
+                return
+            self.passthrough(self.buf[:start])
+            del self.buf[:start]
+            if len(self.buf) < 6 or len(self.buf) < 6 + self.buf[3]:
+                return
+            length = self.buf[3]
+            frame = bytes(self.buf[: 6 + length])
+            if crc8(frame[2 : 5 + length]) != frame[5 + length]:
+                self.bad_crc += 1
+                # not a frame after all, skip the start bytes and resynchronize
+                self.passthrough(self.buf[:1])
+                del self.buf[:1]
+                continue
+            del self.buf[: 6 + length]
+            self.record(frame[2], frame[4], frame[5 : 5 + length])
+
+    def passthrough(self, data):
+        self.text += data
+        while b"\n" in self.text:
+            line, _, rest = self.text.partition(b"\n")
+            sys.stderr.write(line.decode(errors="replace") + "\n")
+            self.text = bytearray(rest)
+
+    def unwrap(self, t):
+        if self.last_t is not None and t < self.last_t:
+            self.t_offset += 1 << 32
+        self.last_t = t
+        return (t + self.t_offset) / 1e6
+
+    def record(self, rtype, seq, payload):
+        if self.last_seq is not None:
+            self.lost += (seq - self.last_seq - 1) & 0xFF
+        self.last_seq = seq
+        if rtype not in RECORDS:
+            return
+        name, fmt, fields, scale = RECORDS[rtype]
+        if len(payload) != struct.calcsize(fmt):
+            return
+        t, *values = struct.unpack(fmt, payload)
+        values = [v / s if s != 1 else v for v, s in zip(values, scale)]
+        if rtype == 0x02:
+            values[0] = TIMER_EVENTS.get(values[0], values[0])
+        self.out.write(f"{self.unwrap(t):.6f},{name}," + ",".join(str(v) for v in values) + "\n")
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    port = serial.Serial(sys.argv[1], 115200, timeout=0.1)
+    with open(sys.argv[2], "w") as out:
+        out.write("time_s,type,value1,value2\n")
+        decoder = Decoder(out)
+        port.write(b"S1\n")
+        try:
+            while True:
+                decoder.feed(port.read(4096))
+        except KeyboardInterrupt:
+            pass
+        finally:
+            port.write(b"S0\n")
+            print(f"lost frames: {decoder.lost}, bad crc: {decoder.bad_crc}", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
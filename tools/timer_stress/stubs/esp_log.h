@@ -0,0 +1,16 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdio.h>
+
+// Errors are counted, the stress test fails on any of them
+extern atomic_int stub_log_errors;
+
+#define ESP_LOGE(tag, fmt, ...)                                     \
+    do                                                              \
+    {                                                               \
+        stub_log_errors++;                                          \
+        fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__);     \
+    } while (0)
+#define ESP_LOGW(tag, fmt, ...) ((void)0)
+#define ESP_LOGI(tag, fmt, ...) ((void)0)
+#define ESP_LOGD(tag, fmt, ...) ((void)0)
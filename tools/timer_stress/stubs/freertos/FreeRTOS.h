@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+// Just enough of FreeRTOS for timer_ctrl.c on the host
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
@@ -0,0 +1,58 @@
+#pragma once
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include "FreeRTOS.h"
+
+// Static queue on a pthread mutex, never blocks like the calls in timer_ctrl.c
+typedef struct
+{
+    pthread_mutex_t lock;
+    uint8_t *storage;
+    size_t item_size;
+    unsigned length;
+    unsigned head;
+    unsigned count;
+} StaticQueue_t;
+
+typedef StaticQueue_t *QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreateStatic(unsigned length, size_t item_size, uint8_t *storage, StaticQueue_t *q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    q->storage = storage;
+    q->item_size = item_size;
+    q->length = length;
+    q->head = 0;
+    q->count = 0;
+    return q;
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait)
+{
+    BaseType_t ret = pdFALSE;
+    pthread_mutex_lock(&q->lock);
+    if (q->count < q->length)
+    {
+        memcpy(q->storage + ((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+        q->count++;
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait)
+{
+    BaseType_t ret = pdFALSE;
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0)
+    {
+        memcpy(item, q->storage + q->head * q->item_size, q->item_size);
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+void scale_timer_on();
+void scale_timer_off();
+void scale_timer_reset();
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+void ble_relay_timer(uint16_t seconds, bool running);
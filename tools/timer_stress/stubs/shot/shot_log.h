@@ -0,0 +1,4 @@
+#pragma once
+
+void shot_log_begin(void);
+void shot_log_end(void);
@@ -0,0 +1,235 @@
+/*
+ * Host stress test for the shot timer state machine in main/ui/controller/timer_ctrl.c.
+ *
+ * A presser thread taps start/stop and reset at 20 taps a second while every redraw of the timer
+ * label stalls the controller for a whole second, the longest set_timer() waits for the LVGL lock.
+ * A ticker posts the once a second tick meanwhile. Afterwards the starts, stops and resets the
+ * scale saw must match the tapped sequence applied in order, and no event may have been lost.
+ * Then the auto stop after 30 minutes is checked, also with a stop tapped while it was queued.
+ * Time runs 20 times faster than on the device.
+ *
+ * Build and run from the repository root:
+ *
+ *   gcc -std=gnu11 -O2 -Wall -pthread -Itools/timer_stress/stubs -Imain \
+ *       tools/timer_stress/timer_stress.c main/ui/controller/timer_ctrl.c -o /tmp/timer_stress && /tmp/timer_stress
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "ui/controller/app_ctrl.h"
+#include "ui/controller/timer_ctrl.h"
+#include "stream/usb_stream.h"
+
+#define DEVICE_SECOND_US 50000 // one second on the device
+#define TAP_US (DEVICE_SECOND_US / 20)
+#define PRESSES 2000
+#define AUTO_STOP_TICKS 1801
+
+atomic_int stub_log_errors = 0;
+
+static pthread_mutex_t ctrl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ctrl_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t ctrl_bits = 0;
+static bool ctrl_quit = false;
+
+static atomic_bool ui_busy = true;
+static atomic_bool ticking = true;
+static bool tap_on_auto_stop = false;
+static int shown_seconds = -1;
+static int starts = 0;
+static int stops = 0;
+static int resets = 0;
+
+// what the firmware would call, counted or stalled
+
+void set_timer(int seconds)
+{
+    if (atomic_load(&ui_busy))
+    {
+        usleep(DEVICE_SECOND_US);
+    }
+    shown_seconds = seconds;
+}
+
+void scale_timer_on() { starts++; }
+void scale_timer_off() {}
+void scale_timer_reset() { resets++; }
+void shot_log_begin(void) {}
+void shot_log_end(void) { stops++; }
+// the tick that crosses 30 minutes relays the time just before it queues the auto stop
+void ble_relay_timer(uint16_t seconds, bool running)
+{
+    if (tap_on_auto_stop && running && seconds >= AUTO_STOP_TICKS)
+    {
+        tap_on_auto_stop = false;
+        timer_start_stop_cb();
+    }
+}
+void usb_stream_timer(stream_timer_event_t event, uint16_t seconds) {}
+void app_ctrl_need_seconds(void) {}
+
+void app_ctrl_post(uint32_t events)
+{
+    pthread_mutex_lock(&ctrl_lock);
+    ctrl_bits |= events;
+    pthread_cond_signal(&ctrl_cond);
+    pthread_mutex_unlock(&ctrl_lock);
+}
+
+// The part of app_ctrl's loop that drives the timer
+static void *controller(void *arg)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&ctrl_lock);
+        while (ctrl_bits == 0 && !ctrl_quit)
+        {
+            pthread_cond_wait(&ctrl_cond, &ctrl_lock);
+        }
+        uint32_t bits = ctrl_bits;
+        bool quit = ctrl_quit;
+        ctrl_bits = 0;
+        pthread_mutex_unlock(&ctrl_lock);
+
+        if (bits & CTRL_EVT_TIMER)
+        {
+            timer_process();
+        }
+        if ((bits & CTRL_EVT_SECOND) && get_timer_state() == RUNNING)
+        {
+            timer_tick();
+        }
+        if (quit && bits == 0)
+        {
+            return NULL;
+        }
+    }
+}
+
+static void *ticker(void *arg)
+{
+    while (atomic_load(&ticking))
+    {
+        usleep(DEVICE_SECOND_US);
+        app_ctrl_post(CTRL_EVT_SECOND);
+    }
+    return NULL;
+}
+
+static bool taps[PRESSES]; // true = start/stop, false = reset
+
+static void *presser(void *arg)
+{
+    unsigned seed = 1;
+    for (int i = 0; i < PRESSES; i++)
+    {
+        taps[i] = rand_r(&seed) % 4 != 0;
+        if (taps[i])
+        {
+            timer_start_stop_cb();
+        }
+        else
+        {
+            timer_reset_cb();
+        }
+        timer_state_t state = get_timer_state();
+        if (state != RUNNING && state != STOPPED)
+        {
+            fprintf(stderr, "torn timer state %d\n", state);
+            exit(1);
+        }
+        usleep(TAP_US);
+    }
+    return NULL;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, int got, int want)
+{
+    printf("%-28s %6d %6d  %s\n", what, got, want, ok ? "ok" : "FAIL");
+    if (!ok)
+    {
+        failures++;
+    }
+}
+
+int main(void)
+{
+    timer_init();
+
+    pthread_t ctrl_thread, tick_thread, press_thread;
+    pthread_create(&ctrl_thread, NULL, controller, NULL);
+    pthread_create(&tick_thread, NULL, ticker, NULL);
+    pthread_create(&press_thread, NULL, presser, NULL);
+    pthread_join(press_thread, NULL);
+    atomic_store(&ticking, false);
+    pthread_join(tick_thread, NULL);
+    pthread_mutex_lock(&ctrl_lock);
+    ctrl_quit = true;
+    pthread_cond_signal(&ctrl_cond);
+    pthread_mutex_unlock(&ctrl_lock);
+    pthread_join(ctrl_thread, NULL);
+    timer_process();
+
+    // the taps applied one after the other
+    bool running = false;
+    int want_starts = 0, want_stops = 0, want_resets = 0;
+    for (int i = 0; i < PRESSES; i++)
+    {
+        if (taps[i])
+        {
+            want_starts += !running;
+            want_stops += running;
+            running = !running;
+        }
+        else if (!running)
+        {
+            want_resets++;
+        }
+    }
+    printf("%-28s %6s %6s\n", "", "got", "want");
+    check(starts == want_starts, "starts", starts, want_starts);
+    check(stops == want_stops, "stops", stops, want_stops);
+    check(resets == want_resets, "resets", resets, want_resets);
+    check((get_timer_state() == RUNNING) == running, "running at the end", get_timer_state() == RUNNING, running);
+    check(stub_log_errors == 0, "lost events", stub_log_errors, 0);
+
+    // auto stop, without the stalls
+    atomic_store(&ui_busy, false);
+    if (get_timer_state() == RUNNING)
+    {
+        timer_start_stop_cb();
+    }
+    timer_reset_cb();
+    timer_start_stop_cb();
+    timer_process();
+    for (int i = 0; i < AUTO_STOP_TICKS; i++)
+    {
+        timer_tick();
+    }
+    check(get_timer_state() == STOPPED, "stopped after 30 min", get_timer_state() == STOPPED, 1);
+    check(shown_seconds == 0, "shown after auto stop", shown_seconds, 0);
+
+    // a stop that lands in the queue ahead of the auto stop
+    timer_reset_cb();
+    timer_start_stop_cb();
+    timer_process();
+    int stops_before = stops;
+    tap_on_auto_stop = true;
+    for (int i = 0; i < AUTO_STOP_TICKS; i++)
+    {
+        timer_tick();
+    }
+    check(get_timer_state() == STOPPED, "stopped by the tap", get_timer_state() == STOPPED, 1);
+    check(stops == stops_before + 1, "shot ended once", stops - stops_before, 1);
+    check(shown_seconds == AUTO_STOP_TICKS, "time kept after the tap", shown_seconds, AUTO_STOP_TICKS);
+    check(stub_log_errors == 0, "lost events in total", stub_log_errors, 0);
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}